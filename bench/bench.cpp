@@ -0,0 +1,332 @@
+#include "hhga.hpp"
+#include "stats.hpp"
+#include <new>
+#include <memory>
+#include <cstdlib>
+
+// micro-benchmarks of the featurization kernels, on sites built from test/minigiab
+// usage: hhga_bench [DIR [FILTER]], run by make bench
+// each kernel is repeated for at least BENCH_SECONDS, and reports the time and
+// heap allocations per call, and its throughput in calls, and bytes where it makes some
+
+using namespace std;
+using namespace hhga;
+
+#define BENCH_SECONDS 0.5
+
+// every allocation in the process passes through here, so the kernels' can be counted
+static uint64_t allocation_count = 0;
+
+void* operator new(size_t n) {
+    ++allocation_count;
+    void* p = malloc(n ? n : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// keeps the compiler from discarding the results of a kernel
+static volatile double bench_sink;
+
+// calls lambda, which does ops operations over bytes of input, until enough time
+// has passed to measure it, and prints a line of the report
+static void bench(const string& name, size_t ops, size_t bytes,
+                  const function<void(void)>& lambda) {
+    if (ops == 0) {
+        cout << left << setw(28) << name << " no fixtures" << endl;
+        return;
+    }
+    lambda(); // warm up
+    size_t reps = 0;
+    uint64_t allocations = allocation_count;
+    double start = wall_seconds();
+    double elapsed = 0;
+    while (elapsed < BENCH_SECONDS) {
+        lambda();
+        ++reps;
+        elapsed = wall_seconds() - start;
+    }
+    allocations = allocation_count - allocations;
+    double total_ops = (double)reps * ops;
+    cout << left << setw(28) << name
+         << right << fixed
+         << setw(12) << setprecision(1) << elapsed * 1e9 / total_ops << " ns/op"
+         << setw(10) << setprecision(2) << allocations / total_ops << " allocs/op"
+         << setw(14) << setprecision(0) << total_ops / elapsed << " ops/s";
+    if (bytes) {
+        cout << setw(10) << setprecision(1) << (double)reps * bytes / elapsed / 1e6 << " MB/s";
+    }
+    cout << endl;
+}
+
+int main(int argc, char** argv) {
+
+    string dir = argc > 1 ? argv[1] : "test/minigiab";
+    string filter = argc > 2 ? argv[2] : "";
+    auto wanted = [&](const string& name) {
+        return filter.empty() || name.find(filter) != string::npos;
+    };
+
+    inputs_t in;
+    string vcf_file_name = dir + "/NA12878.chr22.tiny.giab.vcf.gz";
+    if (!in.open({ dir + "/NA12878.chr22.tiny.bam" }, { }, dir + "/q.fa")) {
+        return 1;
+    }
+    vcflib::VariantCallFile vcf_file;
+    vcf_file.open(vcf_file_name);
+    if (!vcf_file.is_open()) {
+        cerr << "[hhga] could not open " << vcf_file_name << endl;
+        return 1;
+    }
+
+    // the fixtures: every site in the VCF, as hhga builds it by default
+    hhga_options_t options;
+    options.class_label = "1";
+    size_t window_size = options.window_length;
+    auto all_genotypes = possible_genotypes(16, 2);
+    vector<unique_ptr<HHGA> > sites;
+    vector<string> genotypes;          // GT of each site's sample
+    vector<string> repeat_windows;     // reference around each site, as for callable_window
+    vector<string> site_alleles;
+    vector<vector<prob_t> > read_quals; // per-read qualities, as the CIGAR decoding converts them
+    vcflib::Variant var(vcf_file);
+    double build_start = wall_seconds();
+    while (vcf_file.getNextVariant(var)) {
+        sites.emplace_back(new HHGA(var, in, options, all_genotypes));
+        if (!var.sampleNames.empty()) {
+            genotypes.push_back(var.samples[var.sampleNames.front()]["GT"].front());
+        }
+        int repeat_window_length = window_size * 8;
+        repeat_windows.push_back(in.fasta_ref.getSubSequence(var.sequenceName,
+                                                             var.position-1 - repeat_window_length/2,
+                                                             repeat_window_length));
+        site_alleles.push_back(var.alleles.back());
+        for (auto& aln : sites.back()->alignments) {
+            vector<prob_t> quals;
+            for (char c : aln.Qualities) quals.push_back(qualityChar2ShortInt(c));
+            read_quals.push_back(quals);
+        }
+    }
+    double build_seconds = wall_seconds() - build_start;
+
+    size_t read_rows = 0;
+    size_t read_cells = 0;
+    for (auto& s : sites) {
+        for (size_t r = 0; r < s->alignments.size(); ++r) {
+            ++read_rows;
+            read_cells += s->read_row(r).size();
+        }
+    }
+    cout << "[hhga] " << sites.size() << " sites, " << read_rows << " reads, built at "
+         << fixed << setprecision(1) << (sites.empty() ? 0 : build_seconds * 1e3 / sites.size())
+         << " ms/site" << endl;
+
+    // reads against each haplotype, as when matching: each site's MSA is packed once,
+    // then every read is compared with every haplotype over the packed rows
+    size_t pairs = 0;
+    for (auto& s : sites) pairs += s->alignments.size() * s->haplotypes.size();
+    if (wanted("msa_pack")) {
+        bench("msa_pack", read_rows, read_cells * sizeof(allele_t), [&](void) {
+                for (auto& s : sites) s->msa.pack();
+            });
+    }
+    auto bench_match = [&](const string& name, packed_compare_t compare) {
+        if (!wanted(name)) return;
+        bench(name, pairs, read_cells * sizeof(allele_t), [&](void) {
+                double t = 0;
+                for (auto& s : sites) {
+                    for (size_t r = 0; r < s->alignments.size(); ++r) {
+                        for (size_t h = 0; h < s->haplotypes.size(); ++h) {
+                            double identity, qualsum;
+                            s->msa.match(s->read_row_offset + r, 1 + h, identity, qualsum, compare);
+                            t += identity + qualsum;
+                        }
+                    }
+                }
+                bench_sink = t;
+            });
+    };
+    bench_match("msa_match", packed_compare);
+    bench_match("msa_match_scalar", packed_compare_scalar);
+    // for comparison, the unpacked definitions the packed kernel replaces, which hhga
+    // itself no longer calls
+    if (wanted("unpacked:pairwise_identity")) {
+        bench("unpacked:pairwise_identity", pairs, read_cells * sizeof(allele_t), [&](void) {
+                double t = 0;
+                for (auto& s : sites) {
+                    for (size_t r = 0; r < s->alignments.size(); ++r) {
+                        for (auto& hap : s->haplotypes) {
+                            t += pairwise_identity(s->read_row(r), hap);
+                        }
+                    }
+                }
+                bench_sink = t;
+            });
+    }
+    if (wanted("unpacked:pairwise_qualsum")) {
+        bench("unpacked:pairwise_qualsum", pairs, read_cells * sizeof(allele_t), [&](void) {
+                double t = 0;
+                for (auto& s : sites) {
+                    for (size_t r = 0; r < s->alignments.size(); ++r) {
+                        for (auto& hap : s->haplotypes) {
+                            t += pairwise_qualsum(s->read_row(r), hap);
+                        }
+                    }
+                }
+                bench_sink = t;
+            });
+    }
+
+    // the projected alleles of each site are projected again through a map built from
+    // them, as the constructor builds it from the decoded ones
+    vector<site_map<pair<int32_t, size_t>, size_t> > projections(sites.size());
+    size_t projected_alleles = 0;
+    for (size_t i = 0; i < sites.size(); ++i) {
+        site_map<int32_t, size_t> pos_max_length;
+        for (auto& aln_alleles : sites[i]->alignment_alleles) {
+            site_map<int32_t, size_t> pos_counts;
+            for (auto& allele : aln_alleles) ++pos_counts[allele.position];
+            for (auto p : pos_counts) {
+                pos_max_length[p.first] = max(pos_max_length[p.first], p.second);
+            }
+            projected_alleles += aln_alleles.size();
+        }
+        size_t j = 0;
+        for (auto p : pos_max_length) {
+            for (size_t k = 0; k < p.second; ++k) {
+                projections[i][make_pair(p.first, k)] = j++;
+            }
+        }
+    }
+    // the rows are copied into a reused buffer, which stops allocating once it has grown
+    alleles_t projected;
+    if (wanted("project_positions")) {
+        bench("project_positions", projected_alleles, 0, [&](void) {
+                for (size_t i = 0; i < sites.size(); ++i) {
+                    for (auto& aln_alleles : sites[i]->alignment_alleles) {
+                        if (aln_alleles.empty()) continue;
+                        projected.assign(aln_alleles.begin(), aln_alleles.end());
+                        sites[i]->project_positions(projected, projections[i]);
+                    }
+                }
+            });
+    }
+
+    // every read row of each site is padded into a scratch MSA, swapped in for the
+    // site's own so it stays intact, within the window the reference row was padded to
+    vector<msa_t> scratch(sites.size());
+    if (wanted("pad_alleles")) {
+        bench("pad_alleles", read_rows, 0, [&](void) {
+                for (size_t i = 0; i < sites.size(); ++i) {
+                    auto& s = sites[i];
+                    pos_t bal_min = s->reference.empty() ? 0 : s->reference[0].position;
+                    scratch[i].reset(s->read_row_offset + s->alignments.size(), window_size);
+                    swap(s->msa, scratch[i]);
+                    size_t row = s->read_row_offset;
+                    for (auto& aln_alleles : s->alignment_alleles) {
+                        s->pad_alleles(aln_alleles, bal_min, bal_min + window_size, row++);
+                    }
+                    swap(s->msa, scratch[i]);
+                }
+            });
+    }
+
+    size_t repeat_bytes = 0;
+    for (auto& w : repeat_windows) repeat_bytes += w.size();
+    if (wanted("repeat_counts")) {
+        bench("repeat_counts", repeat_windows.size(), repeat_bytes, [&](void) {
+                size_t n = 0;
+                for (auto& w : repeat_windows) {
+                    n += repeat_counts(w.size()/2 + 2, w, 16).size();
+                }
+                bench_sink = n;
+            });
+    }
+    if (wanted("entropy")) {
+        bench("entropy", repeat_windows.size(), repeat_bytes, [&](void) {
+                double t = 0;
+                for (auto& w : repeat_windows) t += entropy(w);
+                bench_sink = t;
+            });
+    }
+    if (wanted("callable_window")) {
+        bench("callable_window", repeat_windows.size(), repeat_bytes, [&](void) {
+                int t = 0;
+                for (size_t i = 0; i < repeat_windows.size(); ++i) {
+                    auto& w = repeat_windows[i];
+                    auto f = callable_window(w.size()/2 + 2, w, site_alleles[i], 3, 1.8);
+                    t += f.second - f.first;
+                }
+                bench_sink = t;
+            });
+    }
+
+    // an indel of each length from 1 to 8 at every tenth base of each read
+    size_t indel_ops = 0;
+    for (auto& q : read_quals) indel_ops += 8 * ((q.size() + 9) / 10);
+    if (wanted("deletion_probs")) {
+        bench("deletion_probs", indel_ops, 0, [&](void) {
+                double t = 0;
+                for (auto& q : read_quals) {
+                    for (size_t sp = 0; sp < q.size(); sp += 10) {
+                        for (size_t l = 1; l <= 8; ++l) t += deletion_probs(q, sp, l).front();
+                    }
+                }
+                bench_sink = t;
+            });
+    }
+    if (wanted("insertion_probs")) {
+        bench("insertion_probs", indel_ops, 0, [&](void) {
+                double t = 0;
+                for (auto& q : read_quals) {
+                    for (size_t sp = 0; sp < q.size(); sp += 10) {
+                        for (size_t l = 1; l <= 8; ++l) t += insertion_probs(q, sp, l).front();
+                    }
+                }
+                bench_sink = t;
+            });
+    }
+
+    if (wanted("label_for_genotype")) {
+        bench("label_for_genotype", genotypes.size(), 0, [&](void) {
+                int t = 0;
+                for (auto& gt : genotypes) t += label_for_genotype(gt, all_genotypes);
+                bench_sink = t;
+            });
+    }
+
+    // the output of each site, in the buffer main reuses between sites
+    size_t vw_bytes = 0;
+    size_t str_bytes = 0;
+    for (auto& s : sites) {
+        string buffer;
+        s->vw(buffer);
+        vw_bytes += buffer.size();
+        str_bytes += s->str().size();
+    }
+    if (wanted("vw")) {
+        string buffer;
+        bench("vw", sites.size(), vw_bytes, [&](void) {
+                for (auto& s : sites) {
+                    buffer.clear();
+                    s->vw(buffer);
+                }
+            });
+    }
+    if (wanted("str")) {
+        bench("str", sites.size(), str_bytes, [&](void) {
+                size_t n = 0;
+                for (auto& s : sites) n += s->str().size();
+                bench_sink = n;
+            });
+    }
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# end-to-end scaling of hhga over synthetic data made by hhga_synth
+# for each depth, a workload is simulated once, and hhga is run over it at each window size
+# prints a TSV with the sites/s, peak RSS and output bytes/s of every run
+# usage: bench/scaling.sh [DIR], run by make bench-scaling
+# these can be set in the environment:
+#   DEPTHS     coverages to simulate (default: 30 100 500 1000 5000)
+#   WINDOWS    --window-size of each run (default: 16 32 64 128)
+#   LENGTH     of the reference (default: 20000)
+#   DENSITY    variants per kb (default: 2)
+#   UNITIGS    if set, simulate unitigs and pass them to hhga
+#   THREADS    hhga --threads (default: 1)
+#   HHGA_ARGS  further options for hhga, such as --downsample 100 or --features aln,match
+
+dir=${1:-bench/scaling}
+depths=${DEPTHS:-30 100 500 1000 5000}
+windows=${WINDOWS:-16 32 64 128}
+length=${LENGTH:-20000}
+density=${DENSITY:-2}
+threads=${THREADS:-1}
+bin=$(dirname $0)/../bin
+
+mkdir -p $dir || exit 1
+
+echo -e "depth\twindow\tsites\treads\twall\tsites_per_s\tpeak_rss_kb\tbytes\tbytes_per_s"
+for depth in $depths
+do
+    data=$dir/synth.$depth
+    unitig_args=""
+    if [ ! -z "$UNITIGS" ];
+    then
+        unitig_args="-u $data.unitigs.bam"
+    fi
+    if [ ! -e $data.bam.bai ] || ( [ ! -z "$UNITIGS" ] && [ ! -e $data.unitigs.bam.bai ] );
+    then
+        $bin/hhga_synth -o $data -L $length -d $depth -v $density ${UNITIGS:+-u} 2>/dev/null || exit 1
+    fi
+    for window in $windows
+    do
+        run=$dir/run.$depth.$window
+        $bin/hhga -f $data.fa -b $data.bam $unitig_args -v $data.vcf.gz -w $window \
+            -j $threads -T $run.json -M -O $run.vw $HHGA_ARGS 2>$run.log || exit 1
+        # the totals of the report come before those of each contig
+        sites=$(grep -m1 '"sites"' $run.json | tr -dc '0-9')
+        reads=$(grep -m1 '"reads_fetched"' $run.json | tr -dc '0-9')
+        wall=$(grep -m1 '"wall"' $run.json | sed 's/.*: \([0-9.e+-]*\),/\1/')
+        rss=$(grep 'peak RSS' $run.log | tr -dc '0-9')
+        bytes=$(wc -c < $run.vw)
+        echo "$depth $window $sites $reads $wall $rss $bytes" \
+            | awk '{ w = $5 > 0 ? $5 : 1; printf "%d\t%d\t%d\t%d\t%.3f\t%.1f\t%d\t%d\t%.0f\n", $1, $2, $3, $4, $5, $3/w, $6, $7, $7/w }'
+    done
+done
@@ -0,0 +1,355 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+#include "bamtools/api/BamWriter.h"
+#include "bamtools/api/BamReader.h"
+#include "htslib/bgzf.h"
+#include "htslib/tbx.h"
+
+// writes a deterministic synthetic workload for benchmarking hhga at scale:
+// a random reference with tandem repeats, a candidate VCF of true and false variants,
+// a coordinate-sorted and indexed BAM of reads from the diploid genome they make,
+// and optionally unitigs tiling it
+// the same options and seed always give the same files
+
+using namespace std;
+
+void printUsage(int argc, char** argv) {
+    cerr << "usage: " << argv[0] << " -o PREFIX [options]" << endl
+         << endl
+         << "options:" << endl
+         << "    -h, --help              this dialog" << endl
+         << "    -o, --output PREFIX     write PREFIX.fa, PREFIX.vcf.gz and PREFIX.bam, with their indexes" << endl
+         << "    -L, --length N          reference length (default: 100000)" << endl
+         << "    -d, --depth N           read coverage, from 30 up to thousands (default: 30)" << endl
+         << "    -l, --read-length N     (default: 150)" << endl
+         << "    -v, --density N         variants per kb (default: 1)" << endl
+         << "    -i, --indel-fraction X  of variants that are insertions or deletions (default: 0.2)" << endl
+         << "    -s, --str-fraction X    of variants that change the length of a tandem repeat (default: 0.1)" << endl
+         << "    -f, --false-fraction X  of candidates that are not in the genome, with GT 0/0 (default: 0.2)" << endl
+         << "    -e, --error-rate X      per-base substitution rate of the reads (default: 0.001)" << endl
+         << "    -u, --unitigs           also write PREFIX.unitigs.bam, tiling each haplotype" << endl
+         << "    -S, --seed N            (default: 0)" << endl;
+}
+
+// splitmix64, as the standard distributions differ between libraries
+class rng_t {
+public:
+    rng_t(uint64_t seed) : state(seed) { }
+    uint64_t next(void) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    double uniform(void) { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    uint64_t below(uint64_t n) { return next() % n; }
+    char base(void) { return "ACGT"[below(4)]; }
+private:
+    uint64_t state;
+};
+
+struct variant_t {
+    int32_t pos; // 0-based, of the first reference base
+    string ref;
+    string alt;
+    int gt[2];   // the allele on each haplotype
+};
+
+// a haplotype, with the reference position of each base, or -1 where it was inserted
+struct haplotype_t {
+    string seq;
+    vector<int32_t> ref_pos;
+};
+
+// the alignment of seq[begin, end) of a haplotype to the reference
+static void align_segment(const haplotype_t& hap, size_t begin, size_t end,
+                          BamTools::BamAlignment& aln) {
+    aln.CigarData.clear();
+    auto add = [&](char type, uint32_t length) {
+        if (!aln.CigarData.empty() && aln.CigarData.back().Type == type) {
+            aln.CigarData.back().Length += length;
+        } else {
+            aln.CigarData.push_back(BamTools::CigarOp(type, length));
+        }
+    };
+    // reads start on a reference base, so only their ends can be inserted
+    aln.Position = hap.ref_pos[begin];
+    int32_t last = -1;
+    for (size_t i = begin; i < end; ++i) {
+        int32_t r = hap.ref_pos[i];
+        if (r < 0) {
+            add('I', 1);
+        } else {
+            if (last >= 0 && r > last + 1) add('D', r - last - 1);
+            add('M', 1);
+            last = r;
+        }
+    }
+    if (aln.CigarData.back().Type == 'I') aln.CigarData.back().Type = 'S';
+}
+
+int main(int argc, char** argv) {
+
+    string prefix;
+    int32_t length = 100000;
+    double depth = 30;
+    int read_length = 150;
+    double density = 1;
+    double indel_fraction = 0.2;
+    double str_fraction = 0.1;
+    double false_fraction = 0.2;
+    double error_rate = 0.001;
+    bool unitigs = false;
+    uint64_t seed = 0;
+
+    int c;
+    while (true) {
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"output", required_argument, 0, 'o'},
+            {"length", required_argument, 0, 'L'},
+            {"depth", required_argument, 0, 'd'},
+            {"read-length", required_argument, 0, 'l'},
+            {"density", required_argument, 0, 'v'},
+            {"indel-fraction", required_argument, 0, 'i'},
+            {"str-fraction", required_argument, 0, 's'},
+            {"false-fraction", required_argument, 0, 'f'},
+            {"error-rate", required_argument, 0, 'e'},
+            {"unitigs", no_argument, 0, 'u'},
+            {"seed", required_argument, 0, 'S'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+        c = getopt_long(argc, argv, "ho:L:d:l:v:i:s:f:e:uS:", long_options, &option_index);
+        if (c == -1) break;
+        switch (c) {
+        case 'o': prefix = optarg; break;
+        case 'L': length = atoi(optarg); break;
+        case 'd': depth = atof(optarg); break;
+        case 'l': read_length = atoi(optarg); break;
+        case 'v': density = atof(optarg); break;
+        case 'i': indel_fraction = atof(optarg); break;
+        case 's': str_fraction = atof(optarg); break;
+        case 'f': false_fraction = atof(optarg); break;
+        case 'e': error_rate = atof(optarg); break;
+        case 'u': unitigs = true; break;
+        case 'S': seed = strtoull(optarg, NULL, 10); break;
+        case 'h':
+            printUsage(argc, argv);
+            return 0;
+        default:
+            printUsage(argc, argv);
+            return 1;
+        }
+    }
+    if (prefix.empty() || length < 4 * read_length || read_length < 1 || depth <= 0) {
+        printUsage(argc, argv);
+        return 1;
+    }
+
+    rng_t rng(seed);
+    string seq_name = "synth";
+
+    // the reference, and the candidates, spaced so that no two overlap
+    // sites are at least half the spacing apart, more than the longest repeat written
+    string ref;
+    for (int32_t i = 0; i < length; ++i) ref.push_back(rng.base());
+    vector<variant_t> variants;
+    int32_t spacing = max(128, (int)(1000 / max(density, 1e-3)));
+    for (int32_t p = spacing / 2; p + spacing < length - read_length; p += spacing) {
+        // jitter each site within the middle of its slot
+        int32_t pos = p + (int32_t)rng.below(spacing / 2) - spacing / 4;
+        if (pos < read_length) continue;
+        variant_t v;
+        double kind = rng.uniform();
+        if (kind < str_fraction) {
+            // a repeat of a 1-4 bp unit, 6-15 copies, which gains or loses a copy
+            string unit;
+            size_t unit_length = 1 + rng.below(4);
+            for (size_t i = 0; i < unit_length; ++i) unit.push_back(rng.base());
+            int copies = 6 + rng.below(10);
+            for (int i = 0; i < copies; ++i) {
+                ref.replace(pos + 1 + i * unit_length, unit_length, unit);
+            }
+            v.pos = pos;
+            v.ref = ref.substr(pos, 1);
+            v.alt = v.ref + unit;
+            if (rng.below(2)) swap(v.ref, v.alt);
+        } else if (kind < str_fraction + indel_fraction) {
+            size_t indel_length = 1 + rng.below(10);
+            v.pos = pos;
+            v.ref = ref.substr(pos, 1);
+            v.alt = v.ref;
+            if (rng.below(2)) {
+                for (size_t i = 0; i < indel_length; ++i) v.alt.push_back(rng.base());
+            } else {
+                v.ref = ref.substr(pos, 1 + indel_length);
+            }
+        } else {
+            v.pos = pos;
+            v.ref = ref.substr(pos, 1);
+            do { v.alt = string(1, rng.base()); } while (v.alt == v.ref);
+        }
+        if (rng.uniform() < false_fraction) {
+            v.gt[0] = v.gt[1] = 0;
+        } else if (rng.below(3) == 0) {
+            v.gt[0] = v.gt[1] = 1;
+        } else {
+            v.gt[0] = rng.below(2);
+            v.gt[1] = 1 - v.gt[0];
+        }
+        variants.push_back(v);
+    }
+
+    ofstream fasta(prefix + ".fa");
+    fasta << ">" << seq_name << "\n";
+    for (int32_t i = 0; i < length; i += 60) {
+        fasta << ref.substr(i, 60) << "\n";
+    }
+    fasta.close();
+    ofstream fai(prefix + ".fa.fai");
+    fai << seq_name << "\t" << length << "\t" << seq_name.size() + 2 << "\t60\t61\n";
+    fai.close();
+
+    // the candidates, compressed and indexed for --region
+    string vcf_name = prefix + ".vcf.gz";
+    BGZF* vcf = bgzf_open(vcf_name.c_str(), "w");
+    if (!vcf) {
+        cerr << "[hhga] could not open " << vcf_name << " for writing" << endl;
+        return 1;
+    }
+    string vcf_text = "##fileformat=VCFv4.1\n"
+        "##source=hhga_synth\n"
+        "##contig=<ID=" + seq_name + ",length=" + to_string(length) + ">\n"
+        "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
+        "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tsynthetic\n";
+    for (auto& v : variants) {
+        vcf_text += seq_name + "\t" + to_string(v.pos + 1) + "\t.\t" + v.ref + "\t" + v.alt
+            + "\t50\t.\t.\tGT\t" + to_string(min(v.gt[0], v.gt[1])) + "/"
+            + to_string(max(v.gt[0], v.gt[1])) + "\n";
+    }
+    if (bgzf_write(vcf, vcf_text.data(), vcf_text.size()) < 0 || bgzf_close(vcf) < 0
+        || tbx_index_build(vcf_name.c_str(), 0, &tbx_conf_vcf) != 0) {
+        cerr << "[hhga] error writing " << vcf_name << endl;
+        return 1;
+    }
+
+    // the two haplotypes
+    haplotype_t haps[2];
+    for (int k = 0; k < 2; ++k) {
+        auto& hap = haps[k];
+        size_t next = 0;
+        for (int32_t p = 0; p < length; ) {
+            if (next < variants.size() && variants[next].pos == p) {
+                auto& v = variants[next++];
+                if (v.gt[k]) {
+                    if (v.ref.size() == v.alt.size()) {
+                        for (size_t i = 0; i < v.alt.size(); ++i) {
+                            hap.seq.push_back(v.alt[i]);
+                            hap.ref_pos.push_back(p + i);
+                        }
+                    } else {
+                        // indels share their first base with the reference
+                        hap.seq.push_back(v.alt[0]);
+                        hap.ref_pos.push_back(p);
+                        for (size_t i = 1; i < v.alt.size(); ++i) {
+                            hap.seq.push_back(v.alt[i]);
+                            hap.ref_pos.push_back(-1);
+                        }
+                    }
+                    p += v.ref.size();
+                    continue;
+                }
+            }
+            hap.seq.push_back(ref[p]);
+            hap.ref_pos.push_back(p);
+            ++p;
+        }
+    }
+
+    // the reads, drawn as the reference is swept so they come out sorted
+    // each haplotype gets half the depth, spread over the bases where reads can start
+    string header = "@HD\tVN:1.5\tSO:coordinate\n@SQ\tSN:" + seq_name + "\tLN:" + to_string(length) + "\n";
+    BamTools::RefVector refs = { BamTools::RefData(seq_name, length) };
+    BamTools::BamWriter reads_out;
+    BamTools::BamWriter unitigs_out;
+    string bam_name = prefix + ".bam";
+    string unitig_name = prefix + ".unitigs.bam";
+    if (!reads_out.Open(bam_name, header, refs)
+        || (unitigs && !unitigs_out.Open(unitig_name, header, refs))) {
+        cerr << "[hhga] could not open " << (unitigs ? unitig_name : bam_name) << " for writing" << endl;
+        return 1;
+    }
+    double starts_per_base = depth / 2 / read_length;
+    int unitig_length = 1000;
+    int unitig_step = 500;
+    size_t read_id = 0;
+    size_t unitig_id = 0;
+    size_t hap_index[2] = { 0, 0 };
+    BamTools::BamAlignment aln;
+    for (int32_t p = 0; p < length; ++p) {
+        for (int k = 0; k < 2; ++k) {
+            auto& hap = haps[k];
+            size_t& h = hap_index[k];
+            while (h < hap.ref_pos.size() && (hap.ref_pos[h] < p)) ++h;
+            if (h >= hap.ref_pos.size() || hap.ref_pos[h] != p) continue;
+            if (h + read_length <= hap.seq.size()) {
+                int count = (int)starts_per_base;
+                if (rng.uniform() < starts_per_base - count) ++count;
+                for (int n = 0; n < count; ++n) {
+                    aln = BamTools::BamAlignment();
+                    aln.Name = "r" + to_string(read_id++);
+                    aln.RefID = 0;
+                    aln.MapQuality = 60;
+                    aln.SetIsReverseStrand(rng.below(2));
+                    aln.QueryBases = hap.seq.substr(h, read_length);
+                    aln.Qualities.clear();
+                    for (auto& b : aln.QueryBases) {
+                        if (rng.uniform() < error_rate) {
+                            char e;
+                            do { e = rng.base(); } while (e == b);
+                            b = e;
+                        }
+                        aln.Qualities.push_back(33 + 25 + rng.below(16));
+                    }
+                    aln.Length = read_length;
+                    align_segment(hap, h, h + read_length, aln);
+                    reads_out.SaveAlignment(aln);
+                }
+            }
+            if (unitigs && h % unitig_step == 0) {
+                size_t end = min(h + unitig_length, hap.seq.size());
+                aln = BamTools::BamAlignment();
+                aln.Name = "u" + to_string(unitig_id++);
+                aln.RefID = 0;
+                aln.MapQuality = 60;
+                aln.QueryBases = hap.seq.substr(h, end - h);
+                aln.Qualities = string(end - h, 'I');
+                aln.Length = end - h;
+                align_segment(hap, h, end, aln);
+                unitigs_out.SaveAlignment(aln);
+            }
+        }
+    }
+    reads_out.Close();
+    if (unitigs) unitigs_out.Close();
+
+    // hhga seeks with the BAM indexes
+    for (auto& name : unitigs ? vector<string>{ bam_name, unitig_name } : vector<string>{ bam_name }) {
+        BamTools::BamReader reader;
+        if (!reader.Open(name) || !reader.CreateIndex(BamTools::BamIndex::STANDARD)) {
+            cerr << "[hhga] could not index " << name << endl;
+            return 1;
+        }
+    }
+
+    cerr << "[hhga] wrote " << variants.size() << " candidates and " << read_id << " reads"
+         << (unitigs ? " and " + to_string(unitig_id) + " unitigs" : "") << " to " << prefix << endl;
+    return 0;
+}
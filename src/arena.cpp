@@ -0,0 +1,69 @@
+#include "arena.hpp"
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+
+namespace hhga {
+
+thread_local site_arena_t* current_arena = nullptr;
+atomic<uint64_t> site_heap_allocations(0);
+
+site_arena_t::site_arena_t(size_t b) : block_size(b) { }
+
+site_arena_t::~site_arena_t(void) {
+    for (auto& b : blocks) free(b.first);
+}
+
+void site_arena_t::add_block(size_t bytes) {
+    char* b = (char*) malloc(bytes);
+    if (!b) throw std::bad_alloc();
+    blocks.push_back(make_pair(b, bytes));
+    capacity += bytes;
+    ++mallocs;
+}
+
+void* site_arena_t::allocate(size_t bytes) {
+    // keep everything aligned for any type
+    bytes = (bytes + 15) & ~(size_t)15;
+    while (current < blocks.size()
+           && offset + bytes > blocks[current].second) {
+        ++current;
+        offset = 0;
+    }
+    if (current == blocks.size()) {
+        add_block(max(block_size, bytes));
+        offset = 0;
+    }
+    void* p = blocks[current].first + offset;
+    offset += bytes;
+    in_use += bytes;
+    peak = max(peak, in_use);
+    ++allocations;
+    return p;
+}
+
+void site_arena_t::rewind(void) {
+    ++sites;
+    if (blocks.size() > 1) {
+        // the last site spilled over, so give the next one a single block that fits it
+        for (auto& b : blocks) free(b.first);
+        blocks.clear();
+        capacity = 0;
+        add_block(max(block_size, peak));
+    }
+    current = 0;
+    offset = 0;
+    in_use = 0;
+}
+
+long peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on OS X
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+}
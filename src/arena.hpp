@@ -0,0 +1,110 @@
+#ifndef HHGA_ARENA_H
+#define HHGA_ARENA_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <functional>
+
+namespace hhga {
+
+using namespace std;
+
+// a monotonic arena backing the containers of one site
+// memory is handed out by bumping a pointer and reclaimed all at once by rewind(),
+// so a worker that rewinds between sites stops calling malloc once it has seen
+// its largest site
+class site_arena_t {
+public:
+    site_arena_t(size_t block_size = 1 << 20);
+    site_arena_t(const site_arena_t&) = delete;
+    ~site_arena_t(void);
+    void* allocate(size_t bytes);
+    // forget everything allocated since the last rewind
+    // if the site needed more than one block, they are merged for the next one
+    void rewind(void);
+
+    // counters, for checking that steady state is allocation-free
+    uint64_t sites = 0;       // rewinds
+    uint64_t allocations = 0; // served from the arena
+    uint64_t mallocs = 0;     // blocks requested from the system
+    size_t in_use = 0;        // bytes since the last rewind
+    size_t peak = 0;          // the most bytes used by one site
+    size_t capacity = 0;      // bytes held in blocks
+
+private:
+    size_t block_size;
+    vector<pair<char*, size_t> > blocks;
+    size_t current = 0;
+    size_t offset = 0;
+    void add_block(size_t bytes);
+};
+
+// the arena that site_allocator draws from on this thread, if any
+extern thread_local site_arena_t* current_arena;
+// allocations made by site containers while no arena was active
+extern atomic<uint64_t> site_heap_allocations;
+
+// makes an arena current for the life of the scope
+class arena_scope_t {
+public:
+    arena_scope_t(site_arena_t& arena) : prev(current_arena) { current_arena = &arena; }
+    ~arena_scope_t(void) { current_arena = prev; }
+private:
+    site_arena_t* prev;
+};
+
+// each block records where it came from, so memory is always returned correctly,
+// even when a container outlives the scope that allocated it from the heap
+#define SITE_ALLOC_HEADER 16
+
+template <class T>
+class site_allocator {
+public:
+    typedef T value_type;
+    site_allocator(void) noexcept { }
+    template <class U> site_allocator(const site_allocator<U>&) noexcept { }
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T) + SITE_ALLOC_HEADER;
+        char* p;
+        if (current_arena) {
+            p = (char*) current_arena->allocate(bytes);
+            *(site_arena_t**) p = current_arena;
+        } else {
+            p = (char*) ::operator new(bytes);
+            *(site_arena_t**) p = nullptr;
+            ++site_heap_allocations;
+        }
+        return (T*)(p + SITE_ALLOC_HEADER);
+    }
+    void deallocate(T* t, size_t n) noexcept {
+        char* p = (char*) t - SITE_ALLOC_HEADER;
+        // arena memory is reclaimed when the arena is rewound
+        if (*(site_arena_t**) p == nullptr) {
+            ::operator delete(p);
+        }
+    }
+};
+
+template <class T, class U>
+bool operator==(const site_allocator<T>&, const site_allocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const site_allocator<T>&, const site_allocator<U>&) { return false; }
+
+template <class T>
+using site_vector = std::vector<T, site_allocator<T> >;
+template <class K, class V>
+using site_map = std::map<K, V, std::less<K>, site_allocator<std::pair<const K, V> > >;
+template <class K>
+using site_set = std::set<K, std::less<K>, site_allocator<K> >;
+
+// the high water mark of the process's resident set, in kB
+long peak_rss_kb(void);
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "bubble.hpp"
+#include <map>
+#include <cstdlib>
+
+namespace hhga {
+
+BubbleAligner::BubbleAligner(vg::VG& vgraph) {
+    nt_table = gssw_create_nt_table();
+    score_matrix = gssw_create_score_matrix(BUBBLE_MATCH, BUBBLE_MISMATCH);
+
+    // gssw fills nodes in the order they are added, which must be topological
+    // site graphs are built flat from one variant, so every edge runs forward
+    map<vg::id_t, vg::Node*> nodes;
+    map<vg::id_t, vector<vg::id_t> > next;
+    map<vg::id_t, int> in_degree;
+    vgraph.for_each_node([&](vg::Node* n) {
+            nodes[n->id()] = n;
+            in_degree[n->id()];
+        });
+    vgraph.for_each_edge([&](vg::Edge* e) {
+            if (e->from_start() || e->to_end()) return;
+            next[e->from()].push_back(e->to());
+            ++in_degree[e->to()];
+        });
+    vector<vg::id_t> order;
+    vector<vg::id_t> ready;
+    for (auto& d : in_degree) {
+        if (d.second == 0) ready.push_back(d.first);
+    }
+    while (!ready.empty()) {
+        auto id = ready.back();
+        ready.pop_back();
+        order.push_back(id);
+        for (auto to : next[id]) {
+            if (--in_degree[to] == 0) ready.push_back(to);
+        }
+    }
+
+    graph = gssw_graph_create(order.size());
+    sequences.reserve(order.size());
+    map<vg::id_t, gssw_node*> gssw_nodes;
+    for (auto id : order) {
+        sequences.push_back(nodes[id]->sequence());
+        auto node = gssw_node_create(nullptr, id, sequences.back().c_str(), nt_table, score_matrix);
+        gssw_nodes[id] = node;
+        gssw_graph_add_node(graph, node);
+    }
+    for (auto& n : next) {
+        for (auto to : n.second) {
+            gssw_nodes_add_edge(gssw_nodes[n.first], gssw_nodes[to]);
+        }
+    }
+}
+
+BubbleAligner::~BubbleAligner(void) {
+    gssw_graph_destroy(graph);
+    free(nt_table);
+    free(score_matrix);
+}
+
+void BubbleAligner::align(const string& seq, const string& quals,
+                          const function<void(vg::id_t node, int qual)>& lambda) {
+    // as vg sets it
+    int32_t mask_len = max(15, (int)seq.size() / 2);
+    gssw_graph_fill(graph, seq.c_str(), nt_table, score_matrix,
+                    BUBBLE_GAP_OPEN, BUBBLE_GAP_EXTEND,
+                    BUBBLE_FULL_LENGTH_BONUS, BUBBLE_FULL_LENGTH_BONUS,
+                    mask_len, 2, true);
+    gssw_graph_mapping* gm = gssw_graph_trace_back(graph, seq.c_str(), seq.size(),
+                                                   nt_table, score_matrix,
+                                                   BUBBLE_GAP_OPEN, BUBBLE_GAP_EXTEND,
+                                                   BUBBLE_FULL_LENGTH_BONUS, BUBBLE_FULL_LENGTH_BONUS);
+    // walk the cigar, crediting each node with the bases of the read aligned to it
+    size_t read_pos = 0;
+    auto& cigar = gm->cigar;
+    for (int32_t i = 0; i < cigar.length; ++i) {
+        auto& nc = cigar.elements[i];
+        int qual = 0;
+        for (int32_t j = 0; j < nc.cigar->length; ++j) {
+            auto& e = nc.cigar->elements[j];
+            switch (e.type) {
+            case 'M': case 'X': case '=': case 'I': case 'S':
+                for (size_t k = read_pos; k < read_pos + e.length && k < quals.size(); ++k) {
+                    qual += quals[k] - 33;
+                }
+                read_pos += e.length;
+                break;
+            default:
+                break;
+            }
+        }
+        lambda(nc.node->id, qual);
+    }
+    gssw_graph_mapping_destroy(gm);
+    gssw_graph_clear(graph);
+}
+
+}
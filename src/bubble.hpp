@@ -0,0 +1,43 @@
+#ifndef HHGA_BUBBLE_H
+#define HHGA_BUBBLE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "vg.hpp"
+#include "gssw.h"
+
+namespace hhga {
+
+using namespace std;
+
+// scores as in vg's default aligner, so both engines agree on which allele a read fits
+#define BUBBLE_MATCH 1
+#define BUBBLE_MISMATCH 4
+#define BUBBLE_GAP_OPEN 6
+#define BUBBLE_GAP_EXTEND 1
+#define BUBBLE_FULL_LENGTH_BONUS 5
+
+// aligns reads to the allele bubble of a site graph with gssw's striped SIMD
+// graph aligner, without building vg::Alignment protobufs
+// the gssw graph is built once and refilled for each read, so it is not thread safe
+class BubbleAligner {
+public:
+    BubbleAligner(vg::VG& graph);
+    BubbleAligner(const BubbleAligner&) = delete;
+    ~BubbleAligner(void);
+    // align seq and call lambda for each node the best alignment passes through,
+    // with the sum of the Phred qualities of the bases aligned to it
+    // quals are as BAM gives them, offset by 33
+    void align(const string& seq, const string& quals,
+               const function<void(vg::id_t node, int qual)>& lambda);
+private:
+    gssw_graph* graph;
+    int8_t* nt_table;
+    int8_t* score_matrix;
+    vector<string> sequences; // gssw points into these
+};
+
+}
+
+#endif
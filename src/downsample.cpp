@@ -0,0 +1,42 @@
+#include "downsample.hpp"
+#include "vw.hpp"
+#include <algorithm>
+
+namespace hhga {
+
+// names break ties between equal hashes, so the order reads arrive in never matters
+static bool key_less(uint32_t k1, const string& n1, uint32_t k2, const string& n2) {
+    return k1 < k2 || (k1 == k2 && n1 < n2);
+}
+
+void ReadSampler::add(const BamTools::BamAlignment& aln) {
+    ++offered;
+    auto& heap = strands[aln.IsReverseStrand()];
+    uint32_t key = vw_uniform_hash(aln.Name.data(), aln.Name.size(), seed);
+    auto heap_less = [](const entry_t& a, const entry_t& b) {
+        return key_less(a.key, a.aln.Name, b.key, b.aln.Name);
+    };
+    if (heap.size() < per_strand) {
+        heap.push_back(entry_t{key, offered, aln});
+        push_heap(heap.begin(), heap.end(), heap_less);
+    } else if (per_strand
+               && key_less(key, aln.Name, heap.front().key, heap.front().aln.Name)) {
+        // only reads that displace one are copied
+        pop_heap(heap.begin(), heap.end(), heap_less);
+        heap.back() = entry_t{key, offered, aln};
+        push_heap(heap.begin(), heap.end(), heap_less);
+    }
+}
+
+void ReadSampler::for_each(const function<void(BamTools::BamAlignment&)>& lambda) {
+    vector<entry_t*> kept;
+    for (auto& heap : strands) {
+        for (auto& e : heap) kept.push_back(&e);
+    }
+    sort(kept.begin(), kept.end(), [](const entry_t* a, const entry_t* b) {
+            return a->order < b->order;
+        });
+    for (auto e : kept) lambda(e->aln);
+}
+
+}
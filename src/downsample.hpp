@@ -0,0 +1,41 @@
+#ifndef HHGA_DOWNSAMPLE_H
+#define HHGA_DOWNSAMPLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "bamtools/api/BamAlignment.h"
+
+namespace hhga {
+
+using namespace std;
+
+// a reservoir of at most per_strand reads on each strand, filled as they are read
+// the reads kept are those whose names hash lowest under the seed, so the choice
+// depends only on which reads are offered, and a read kept at one site is kept at
+// any overlapping site where it competes with the same reads, as are both mates
+class ReadSampler {
+public:
+    ReadSampler(size_t per_strand, uint32_t seed) : per_strand(per_strand), seed(seed) { }
+    void add(const BamTools::BamAlignment& aln);
+    // reads offered, kept or not
+    size_t seen(void) const { return offered; }
+    // the kept reads, in the order they were added
+    void for_each(const function<void(BamTools::BamAlignment&)>& lambda);
+private:
+    struct entry_t {
+        uint32_t key;
+        size_t order;
+        BamTools::BamAlignment aln;
+    };
+    size_t per_strand;
+    uint32_t seed;
+    size_t offered = 0;
+    // max-heaps on the key, so the read to replace is at the front
+    vector<entry_t> strands[2];
+};
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include "genotype.hpp"
+#include <cmath>
+#include <algorithm>
+
+namespace hhga {
+
+static uint64_t choose(uint64_t n, uint64_t k) {
+    if (k > n) return 0;
+    uint64_t c = 1;
+    for (uint64_t i = 1; i <= k; ++i) {
+        c = c * (n - k + i) / i;
+    }
+    return c;
+}
+
+uint64_t genotype_count(int allele_count, int ploidy) {
+    return choose(allele_count + ploidy - 1, ploidy);
+}
+
+// a_1 <= ... <= a_k maps to the k-subset a_i + i - 1, whose colex rank
+// is the sum of C(a_i + i - 1, i)
+uint64_t genotype_index(const vector<int>& gt) {
+    uint64_t index = 0;
+    for (size_t i = 0; i < gt.size(); ++i) {
+        index += choose(gt[i] + i, i + 1);
+    }
+    return index;
+}
+
+vector<int> genotype_at(uint64_t index, int ploidy) {
+    vector<int> gt(ploidy);
+    for (int i = ploidy; i > 0; --i) {
+        // the largest c with C(c, i) <= index
+        uint64_t c = i - 1;
+        while (choose(c + 1, i) <= index) ++c;
+        index -= choose(c, i);
+        gt[i-1] = c - (i - 1);
+    }
+    return gt;
+}
+
+// the genotypes before gt are those that agree with it up to some allele and have a
+// smaller one there, and for each such allele v the rest is any sorted run from v up
+uint64_t genotype_label_index(const vector<int>& gt, int allele_count) {
+    uint64_t index = 0;
+    int ploidy = gt.size();
+    int prev = 0;
+    for (int i = 0; i < ploidy; ++i) {
+        for (int v = prev; v < gt[i]; ++v) {
+            index += genotype_count(allele_count - v, ploidy - i - 1);
+        }
+        prev = gt[i];
+    }
+    return index;
+}
+
+void genotype_likelihoods(const double* match,
+                          const double* error,
+                          size_t read_count,
+                          size_t haplotype_count,
+                          const vector<vector<int> >& genotypes,
+                          size_t genotype_count,
+                          double* probs,
+                          double* log_likelihoods) {
+    // each genotype is a column of allele dosages, so a read's genotype probabilities
+    // are two small matrix-vector products; with genotypes innermost the loops vectorize
+    vector<double> dosage(haplotype_count * genotype_count, 0);
+    for (size_t g = 0; g < genotype_count; ++g) {
+        auto& gt = genotypes[g];
+        for (auto a : gt) {
+            if ((size_t) a < haplotype_count) {
+                dosage[a * genotype_count + g] += 1.0 / gt.size();
+            }
+        }
+    }
+    vector<double> sample(genotype_count);
+    vector<double> in_gt(genotype_count);
+    std::fill(log_likelihoods, log_likelihoods + genotype_count, 0);
+    for (size_t r = 0; r < read_count; ++r) {
+        const double* m = match + r * haplotype_count;
+        const double* e = error + r * haplotype_count;
+        double* p = probs + r * genotype_count;
+        std::fill(sample.begin(), sample.end(), 0);
+        std::fill(in_gt.begin(), in_gt.end(), 0);
+        for (size_t h = 0; h < haplotype_count; ++h) {
+            const double* d = &dosage[h * genotype_count];
+            double mh = m[h];
+            double eh = e[h];
+            for (size_t g = 0; g < genotype_count; ++g) {
+                sample[g] += mh * d[g];
+                in_gt[g] += eh * d[g];
+            }
+        }
+        bool supports_anything = false;
+        for (size_t g = 0; g < genotype_count; ++g) {
+            p[g] = sample[g] * (1 - in_gt[g]);
+            supports_anything |= p[g] > 0;
+        }
+        if (supports_anything) {
+            for (size_t g = 0; g < genotype_count; ++g) {
+                log_likelihoods[g] += log(p[g]);
+            }
+        }
+    }
+}
+
+}
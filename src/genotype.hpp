@@ -0,0 +1,41 @@
+#ifndef HHGA_GENOTYPE_H
+#define HHGA_GENOTYPE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace hhga {
+
+using namespace std;
+
+// genotypes are sorted multisets of allele indexes, numbered in colex order,
+// which is the order of VCF's GL field: 0/0 0/1 1/1 0/2 1/2 2/2 ...
+// the genotypes of the first n alleles always come first, whatever the allele count
+uint64_t genotype_count(int allele_count, int ploidy);
+// the 0-based index of a sorted genotype, in constant time for a given ploidy
+uint64_t genotype_index(const vector<int>& gt);
+// the inverse of genotype_index
+vector<int> genotype_at(uint64_t index, int ploidy);
+// the 0-based index of a sorted genotype among those of allele_count alleles in
+// lexicographic order, 0/0 0/1 ... 0/n 1/1 ..., which is the order of the --gt-class labels
+uint64_t genotype_label_index(const vector<int>& gt, int allele_count);
+
+// p(read | genotype) for a batch of reads against the first genotype_count genotypes
+// match and error have haplotype_count entries per read: the read's identity with each
+// haplotype, and the probability that its agreement is an error
+// for a genotype, p = mean(match) * (1 - mean(error)) over its alleles
+// probs gets a row of genotype_count values per read, and log_likelihoods the sum of
+// log(p) over the reads that support at least one genotype
+void genotype_likelihoods(const double* match,
+                          const double* error,
+                          size_t read_count,
+                          size_t haplotype_count,
+                          const vector<vector<int> >& genotypes,
+                          size_t genotype_count,
+                          double* probs,
+                          double* log_likelihoods);
+
+}
+
+#endif
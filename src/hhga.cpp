@@ -1,4 +1,5 @@
 #include "hhga.hpp"
+#include <climits>
 
 namespace hhga {
 
@@ -146,6 +147,61 @@ void set_region(vcflib::VariantCallFile& vcffile, const string& region_str) {
     }
 }
 
+static const pair<const char*, uint32_t> feature_names[] = {
+    { "ref", FEATURE_REF },
+    { "hap", FEATURE_HAP },
+    { "geno", FEATURE_GENO },
+    { "aln", FEATURE_ALN },
+    { "col", FEATURE_COL },
+    { "match", FEATURE_MATCH },
+    { "qual", FEATURE_QUAL },
+    { "unitig", FEATURE_UNITIG },
+    { "xmatch", FEATURE_XMATCH },
+    { "depth", FEATURE_DEPTH },
+    { "likelihood", FEATURE_LIKELIHOOD },
+    { "properties", FEATURE_PROPERTIES },
+    { "vgraph", FEATURE_VGRAPH },
+    { "kgraph", FEATURE_KGRAPH },
+    { "software", FEATURE_SOFTWARE }
+};
+
+bool parse_features(const string& list, uint32_t& features) {
+    features = 0;
+    for (auto& name : split(list, ",")) {
+        bool found = false;
+        for (auto& f : feature_names) {
+            if (name == f.first) {
+                features |= f.second;
+                found = true;
+            }
+        }
+        if (!found) {
+            cerr << "[hhga] unknown feature namespace " << name << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool inputs_t::open(const vector<string>& bam_files,
+                    const vector<string>& unitig_files,
+                    const string& fasta_file,
+                    bool use_ref_cache) {
+    if (!bam_reader.Open(bam_files)) {
+        cerr << "could not open input BAM files" << endl;
+        return false;
+    }
+    if (!unitig_reader.Open(unitig_files)) {
+        cerr << "could not open input unitig BAM files" << endl;
+        return false;
+    }
+    fasta_ref.open(fasta_file);
+    if (use_ref_cache && !ref_cache.open(fasta_file)) {
+        return false;
+    }
+    return true;
+}
+
 vector<vector<int> > possible_genotypes(int allele_count, int ploidy) {
     vector<int> alleles;
     for (int i = 0; i < allele_count; ++i) alleles.push_back(i);
@@ -170,21 +226,27 @@ string string_for_genotype(const vector<int>& gt) {
     return join(gs, "/");
 }
 
-int label_for_genotype(const string& gt, const vector<vector<int> >& genotypes) {
-    //auto genotypes = possible_genotypes(allele_count, ploidy);
-    // split the string and turn it into a vector
-    auto genotype = genotype_for_string(gt);
-    int i = 0;
-    for (auto& s : genotypes) {
-        ++i;
-        if (s == genotype) {
-            return i;
+int label_for_genotype(const vector<int>& genotype, const vector<vector<int> >& genotypes) {
+    // genotypes are in lexicographic order, ending with the last allele's homozygote,
+    // so the label can be computed rather than searched for
+    if (!genotypes.empty() && genotype.size() == genotypes.back().size()) {
+        uint64_t i = genotype_label_index(genotype, genotypes.back().back() + 1);
+        if (i < genotypes.size() && genotypes[i] == genotype) {
+            return i + 1;
         }
     }
-    cerr << "warning: unknown genotype '" << gt << "'" << endl;
     return genotypes.size()+1;
 }
 
+int label_for_genotype(const string& gt, const vector<vector<int> >& genotypes) {
+    // split the string and turn it into a vector
+    int label = label_for_genotype(genotype_for_string(gt), genotypes);
+    if (label > genotypes.size()) {
+        cerr << "warning: unknown genotype '" << gt << "'" << endl;
+    }
+    return label;
+}
+
 string genotype_for_label(int label, const vector<vector<int> >& genotypes) {
     if (label > genotypes.size()) {
         cerr << "warning: unknown label '" << label << "'" << endl;
@@ -202,108 +264,42 @@ map<int, double> test_labels(int alt_count) {
     return labels;
 }
 
-pair<int, int> pair_for_gt_class(int gt) {
-    switch (gt) {
-    case 1: // 0/0
-        return make_pair(0,0);
-        break;
-    case 2: // 0/1
-        return make_pair(0,1);
-        break;
-    case 3: // 0/2
-        return make_pair(0,2);
-        break;
-    case 4: // 1/1
-        return make_pair(1,1);
-        break;
-    case 5: // 1/2
-        return make_pair(1,2);
-        break;
-    case 6: // 2/2
-        return make_pair(2,2);
-        break;
-    case 7: // ./.
-        return make_pair(8,8);
-        break;
-    default:
-        break;
-    }
-}
-
-double HHGA::prob_aln_gt(alignment_t* aln, int gt) {
-    auto& match = matches[aln];
-    auto& qsum = qualsum[aln];
-    double prob = 0;
-    auto gtp = pair_for_gt_class(gt);
-    int a = gtp.first;;
-    int b = gtp.second;
-    double prob_sample = match[a]/2 + match[b]/2;
-    double prob_in_gt = 1-(phred2float(qsum[a])/2 + phred2float(qsum[b])/2);
-    double qsumsum = 0;
-    for (auto& q : qsum) {
-        qsumsum += q.second;
-    }
-    double prob_out_gt = 1-phred2float(qsumsum - (qsum[a]/2 + qsum[b]/2));
-    //double prob_error = 1-(phred2float(qsum[a])/2 + phred2float(qsum[b])/2);
-    //double prob_error = phred2float(qsum[a])/2 + phred2float(qsum[b])/2;
-    return prob_sample * prob_in_gt;
-}
-
-double pairwise_qualsum(const vector<allele_t>& h1, const vector<allele_t>& h2) {
+// these define the match features, and msa_t::match must agree with them exactly
+double pairwise_qualsum(const msa_row_t& h1, const msa_row_t& h2) {
     // assert they are normalized
     // that given, we can compare directly
-    map<int, const allele_t*> p1;
-    map<int, const allele_t*> p2;
-    for (size_t i = 0; i < h1.size(); ++i) {
-        p1[i] = &h1[i];
-    }
-    for (size_t i = 0; i < h2.size(); ++i) {
-        p2[i] = &h2[i];
-    }
     int possible = 0;
-    for (auto& p : p2) {
-        auto a2 = p.second->alt;
-        if (a2 != "M") ++possible;
+    for (auto& a2 : h2) {
+        if (a2.alt != 'M') ++possible;
     }
     double qualsum = 0;
-    for (auto& p : p1) {
-        auto a1 = p1[p.first]->alt;
-        if (p2.find(p.first) == p2.end()) continue;
-        auto a2 = p2[p.first]->alt;
+    for (size_t i = 0; i < min(h1.size(), h2.size()); ++i) {
+        auto a1 = h1[i].alt;
+        auto a2 = h2[i].alt;
         //if (possible > 1 && a1 == "R" && a1 == "R") continue; // avoid counting ref bases in indels
-        if (a1 == "M" || a2 == "M") continue;
+        if (a1 == 'M' || a2 == 'M') continue;
         if (a1 == a2) {
-            qualsum += p.second->prob;
+            qualsum += h1[i].prob;
         }
     }
     return (possible ? (double) qualsum / (double) possible : 0);
 }
 
-double pairwise_identity(const vector<allele_t>& h1, const vector<allele_t>& h2) {
+double pairwise_identity(const msa_row_t& h1, const msa_row_t& h2) {
     int count = 0;
     // assert they are normalized
     // that given, we can compare directly
     // if we have a pure reference pair of alleles
     // the match is 1
     // otherwise, we measure identity in terms of the number of non-ref positions that match
-    map<int, const allele_t*> p1;
-    map<int, const allele_t*> p2;
-    for (size_t i = 0; i < h1.size(); ++i) {
-        if (h1[i].alt == "M") continue;
-        p1[i] = &h1[i];
-    }
-    for (size_t i = 0; i < h2.size(); ++i) {
-        if (h2[i].alt == "M") continue;
-        p2[i] = &h2[i];
-    }
-    int possible = p2.size();
-    int seen = 0;
-    for (auto& p : p2) {
-        auto a2 = p2[p.first]->alt;
-        if (p1.find(p.first) == p1.end()) continue;
-        auto a1 = p1[p.first]->alt;
-        if (a1 == "M" || a2 == "M") continue;
-        ++seen;
+    int possible = 0;
+    for (auto& a2 : h2) {
+        if (a2.alt != 'M') ++possible;
+    }
+    for (size_t i = 0; i < min(h1.size(), h2.size()); ++i) {
+        auto a1 = h1[i].alt;
+        auto a2 = h2[i].alt;
+        if (a1 == 'M' || a2 == 'M') continue;
         if (a1 == a2) {
             ++count;
         }
@@ -311,53 +307,51 @@ double pairwise_identity(const vector<allele_t>& h1, const vector<allele_t>& h2)
     return (possible ? (double) count / (double) possible : 0);
 }
 
-bool has_softclip(const vector<allele_t>& aln_alleles) {
+bool has_softclip(const msa_row_t& aln_alleles) {
     for (auto& allele : aln_alleles) {
-        if (allele.alt == "S") return true;
+        if (allele.alt == 'S') return true;
     }
     return false;
 }
 
-int missing_count(const vector<allele_t>& hap) {
+int missing_count(const msa_row_t& hap) {
     int m = 0;
-    for (auto& a : hap) if (a.alt == "M") ++m;
+    for (auto& a : hap) if (a.alt == 'M') ++m;
     return m;
 }
 
-void HHGA::missing_to_ref(vector<vector<allele_t> >& obs) {
+void HHGA::missing_to_ref(site_vector<msa_row_t>& obs) {
     for (auto& hap : obs) {
         size_t i = 0;
-        for (vector<allele_t>::iterator a = hap.begin(); a != hap.end(); ++a, ++i) {
-            if (a->alt == "M") *a = reference[i];
+        for (auto a = hap.begin(); a != hap.end(); ++a, ++i) {
+            if (a->alt == 'M') *a = reference[i];
         }
     }
 }
 
 map<string, int> repeat_counts(int position, const string& sequence, int maxsize) {
     map<string, int> counts;
-    for (int i = 1; i <= maxsize; ++i) {
-        // subseq here i bases
-        string seq = sequence.substr(position, i);
-        // go left.
-
-        int j = position - i;
-        int leftsteps = 0;
-        while (j >= 0 && seq == sequence.substr(j, i)) {
-            j -= i;
-            ++leftsteps;
-        }
-
-        // go right.
-        j = position;
-
-        int rightsteps = 0;
-        while (j + i <= sequence.size() && seq == sequence.substr(j, i)) {
-            j += i;
-            ++rightsteps;
-        }
+    int n = sequence.size();
+    if (position < 0 || position > n) return counts;
+    for (int i = 1; i <= maxsize && position + i <= n; ++i) {
+        // the copies of the i bases at position, found by comparing each base with the
+        // one a unit away, rather than unit by unit
+        // go left, counting the bases of the run with period i before position
+        int left = 0;
+        while (position - left - 1 >= 0
+               && sequence[position - left - 1] == sequence[position - left - 1 + i]) {
+            ++left;
+        }
+        // go right, counting those after the first copy
+        int right = 0;
+        while (position + i + right < n
+               && sequence[position + i + right] == sequence[position + right]) {
+            ++right;
+        }
+        int steps = left / i + 1 + right / i;
         // if we went left and right a non-zero number of times, 
-        if (leftsteps + rightsteps > 1) {
-            counts[seq] = leftsteps + rightsteps;
+        if (steps > 1) {
+            counts[sequence.substr(position, i)] = steps;
         }
     }
 
@@ -438,39 +432,80 @@ pair<int, int> callable_window(int pos,
     // tandem repeats and homopolymers when indels are present
     int right_boundary = pos+1;
     int left_boundary = pos;
+    int n = sequence.size();
     // check for repeats of up to length 16
     for (auto& r : repeat_counts(pos, sequence, 16)) {
-        auto repeatunit = r.first;
-        int rptcount = r.second;
-        //cerr << repeatunit << ":" << rptcount << endl;
-        string repeatstr = repeat(repeatunit, rptcount);
+        auto& repeatunit = r.first;
+        int unit_length = repeatunit.size();
+        int repeat_length = unit_length * r.second;
         // assumption of left-alignment may be problematic... so this should be updated
-        if (repeatstr.size() >= min_repeat_size) { // && is_repeat_unit(alleleseq, repeatunit)) {
+        if (repeat_length >= min_repeat_size) { // && is_repeat_unit(alleleseq, repeatunit)) {
             // determine the boundaries of the repeat
             // adjust to ensure we hit the first of the repeatstr
-            size_t startpos = sequence.find(repeatstr, pos-1-repeatstr.size());
-            left_boundary = min((int)startpos, left_boundary);
-            if (startpos == string::npos) {
-                /*
-                cerr << "could not find repeat sequence?" << endl;
-                cerr << "repeat sequence: " << repeatstr << endl;
-                cerr << sequence << endl;
-                cerr << "matched repeats:" << endl;
-                */
+            // this is the first copy of the repeat from there, found without building it:
+            // where the unit starts a run with its period long enough to hold the repeat
+            // the repeat at pos starts at or before it, so the search ends there
+            int from = pos-1-repeat_length;
+            int startpos = -1; // as string::npos when cast, if from is before the sequence
+            if (from >= 0) {
+                int last = pos;
+                while (last - unit_length >= from
+                       && sequence.compare(last - unit_length, unit_length, repeatunit) == 0) {
+                    last -= unit_length;
+                }
+                // period[q - from] is the length of the run with period unit_length from q
+                vector<int> period(last - from + 1, 0);
+                int run = 0;
+                for (int q = min(last + repeat_length - unit_length, n - unit_length) - 1; q >= from; --q) {
+                    run = sequence[q] == sequence[q + unit_length] ? run + 1 : 0;
+                    if (q <= last) period[q - from] = run;
+                }
+                for (int q = from; q <= last; ++q) {
+                    if (period[q - from] >= repeat_length - unit_length
+                        && sequence.compare(q, unit_length, repeatunit) == 0) {
+                        startpos = q;
+                        break;
+                    }
+                }
+            }
+            left_boundary = min(startpos, left_boundary);
+            if (startpos < 0) {
                 break; // ignore right-repeat boundary in this case
             }
-            right_boundary = max(right_boundary, (int)(left_boundary + repeatstr.size() + 1)); // 1 past edge of repeat
+            right_boundary = max(right_boundary, (int)(left_boundary + repeat_length + 1)); // 1 past edge of repeat
+        }
+    }
+
+    // the window only grows, so its base counts are kept rather than recounted
+    // and its entropy summed over them in the order entropy() would
+    if (min_entropy > 0 && left_boundary > 0 && right_boundary < n-1) {
+        vector<int> base_counts(256, 0);
+        for (int i = left_boundary; i < right_boundary; ++i) {
+            ++base_counts[(unsigned char)sequence[i]];
+        }
+        double ln2 = log(2);
+        auto window_entropy = [&](void) {
+            double length = right_boundary - left_boundary;
+            double ent = 0;
+            for (int c = CHAR_MIN; c <= CHAR_MAX; ++c) {
+                int count = base_counts[(unsigned char)c];
+                if (count) {
+                    double f = (double)count / length;
+                    ent += f * log(f)/ln2;
+                }
+            }
+            return -ent;
+        };
+        while (left_boundary > 0 &&
+               right_boundary < n-1 && //guard
+               window_entropy() < min_entropy) {
+            --left_boundary;
+            ++right_boundary;
+            ++base_counts[(unsigned char)sequence[left_boundary]];
+            ++base_counts[(unsigned char)sequence[right_boundary-1]];
         }
     }
 
-    while (min_entropy > 0 && // ignore if turned off
-           left_boundary > 0 &&
-           right_boundary < sequence.size()-1 && //guard
-           entropy(sequence.substr(left_boundary, right_boundary - left_boundary)) < min_entropy) {
-        --left_boundary;
-        ++right_boundary;
-    }
-
     return make_pair(left_boundary, right_boundary);
     // edge case, the indel is an insertion and matches the reference to the right
     // this means there is a repeat structure in the read, but not the ref
@@ -481,130 +516,156 @@ pair<int, int> callable_window(int pos,
     */
 }
 
-HHGA::HHGA(size_t window_length,
-           BamTools::BamMultiReader& bam_reader,
-           BamTools::BamMultiReader& unitig_reader,
-           FastaReference& fasta_ref,
-           vcflib::VariantCallFile& graph_vcf,
-           size_t graph_window,
-           vcflib::Variant& var,
-           const string& input_name,
-           const string& class_label,
-           const string& gt_class,
+pair<int, int> site_callable_window(const string& repeat_window,
+                                    int repeat_window_start,
+                                    int repeat_window_length,
+                                    double min_repeat_entropy) {
+    int callable_begin_pos = repeat_window_start + repeat_window_length/2 +1;
+    int callable_end_pos = repeat_window_start + repeat_window_length/2 +1;
+    // the window depends only on the reference around the site, not its alleles
+    auto f = callable_window(repeat_window_length/2 +2,
+                             repeat_window,
+                             "",
+                             3, min_repeat_entropy);
+    callable_begin_pos = min((int)(repeat_window_start + f.first), callable_begin_pos);
+    callable_end_pos = max((int)(repeat_window_start + f.second), callable_end_pos);
+    return make_pair(callable_begin_pos, callable_end_pos);
+}
+
+HHGA::HHGA(vcflib::Variant& var,
+           inputs_t& in,
+           const hhga_options_t& options,
            const vector<vector<int> >& all_genotypes,
-           int max_depth,
-           int min_allele_count,
-           double min_repeat_entropy,
-           bool full_overlap,
-           int max_node_size,
-           bool expon,
-           bool show_bases,
-           bool assume_ref) {
-
-    exponentiate = expon;
-
-    if (!gt_class.empty()) {
+           site_stats_t* stats) {
+
+    stage_clock_t clock(stats, STAGE_SETUP);
+    SweepReader* bam_sweep = options.sweep ? &in.bam_sweep : nullptr;
+    SweepReader* unitig_sweep = options.sweep ? &in.unitig_sweep : nullptr;
+    const ReferenceCache* ref_cache = options.use_ref_cache ? &in.ref_cache : nullptr;
+    exponentiate = options.exponentiate;
+    features = options.features;
+    // the graph only feeds these, and its reads are counted for |depth
+    bool use_graph = features & (FEATURE_KGRAPH | FEATURE_VGRAPH);
+    bool count_graph_reads = use_graph || (features & FEATURE_DEPTH);
+
+    if (!options.gt_class.empty()) {
         // convert the genotype into
         // require that it be in
         // 0/0, 0/1, 1/1, 0/2, 1/2, 2/2
-        auto gt = var.samples[var.sampleNames.front()][gt_class].front();
+        auto gt = var.samples[var.sampleNames.front()][options.gt_class].front();
         label = convert(label_for_genotype(gt, all_genotypes));
     } else {
-        label = class_label;
+        label = options.class_label;
     }
 
     // store the names of all the reference sequences in the BAM file
-    map<int, string> referenceIDToName;
-    vector<BamTools::RefData> referenceSequences = bam_reader.GetReferenceData();
-    int i = 0;
+    site_map<int, string> referenceIDToName;
+    vector<BamTools::RefData> referenceSequences = in.bam_reader.GetReferenceData();
+    int ref_count = 0;
     for (BamTools::RefVector::iterator r = referenceSequences.begin();
          r != referenceSequences.end(); ++r) {
-        referenceIDToName[i] = r->RefName;
-        ++i;
+        referenceIDToName[ref_count] = r->RefName;
+        ++ref_count;
     }
 
-    int32_t begin_pos = var.position-1 - window_length/2;
-    int32_t end_pos = begin_pos + window_length;
+    int32_t begin_pos = var.position-1 - options.window_length/2;
+    int32_t end_pos = begin_pos + options.window_length;
     string seq_name = var.sequenceName;
     int32_t center_pos = var.position-1;//begin_pos + (end_pos - begin_pos) / 2;
     //int32_t center_pos = var.position-1 + var.ref.size()/2;
 
+    // reference sequence comes from the packed cache when we have one
+    auto ref_subsequence = [&](const string& name, int start, int length) {
+        return ref_cache ? ref_cache->getSubSequence(name, start, length)
+            : in.fasta_ref.getSubSequence(name, start, length);
+    };
+
     // we'll use this later to cut and pad the matrix
-    string window_ref_seq = fasta_ref.getSubSequence(seq_name, begin_pos, window_length);
+    string window_ref_seq = ref_subsequence(seq_name, begin_pos, options.window_length);
 
-    int repeat_window_length = window_length * 8;
-    int repeat_window_start = var.position-1 - repeat_window_length/2;
-    string repeat_window = fasta_ref.getSubSequence(seq_name, repeat_window_start, repeat_window_length);;
-    int callable_begin_pos = repeat_window_start + repeat_window_length/2 +1;
-    int callable_end_pos = repeat_window_start + repeat_window_length/2 +1;
-    for (auto& allele_seq : var.alleles) {
-        auto f = callable_window(repeat_window_length/2 +2,
-                                 repeat_window,
-                                 allele_seq,
-                                 3, min_repeat_entropy);
-        //cerr << "callable window for " << allele_seq << " " << f.first << "-" << f.second << endl;
-        callable_begin_pos = min((int)(repeat_window_start + f.first), callable_begin_pos);
-        callable_end_pos = max((int)(repeat_window_start + f.second), callable_end_pos);
+    // reads must span the repeats and low-entropy sequence around indels with --min-entropy
+    // the span depends only on the reference, so it comes from the --repeat-track when that covers the site
+    bool biallelic_snp = var.alleles.size() == 2 && var.ref.size() == 1 && var.alleles.back().size() == 1;
+    bool use_repeat_window = options.min_repeat_entropy && !biallelic_snp;
+    int callable_begin_pos = 0;
+    int callable_end_pos = 0;
+    if (use_repeat_window
+        && !(options.repeat_track
+             && options.repeat_track->callable(seq_name, var.position-1, callable_begin_pos, callable_end_pos))) {
+        int repeat_window_length = options.window_length * 8;
+        int repeat_window_start = var.position-1 - repeat_window_length/2;
+        auto f = site_callable_window(ref_subsequence(seq_name, repeat_window_start, repeat_window_length),
+                                      repeat_window_start,
+                                      repeat_window_length,
+                                      options.min_repeat_entropy);
+        callable_begin_pos = f.first;
+        callable_end_pos = f.second;
     }
 
     //cerr << "callable window for site " << callable_begin_pos << "-" << callable_end_pos << endl;
     
-    //vcflib::VariantCallFile& graph_vcf;
     stringstream targetss;
-    auto graph_begin_pos = var.position-1 - graph_window/2;
-    auto graph_end_pos = var.position-1 + var.ref.size() + graph_window/2;
+    auto graph_begin_pos = var.position-1 - options.graph_window/2;
+    auto graph_end_pos = var.position-1 + var.ref.size() + options.graph_window/2;
     targetss << seq_name << ":" << graph_begin_pos << "-" << graph_end_pos;
     auto target = targetss.str();
     //ConstructedChunk construct_chunk(string reference_sequence, string reference_path_name,
     //vector<vcflib::Variant> variants, size_t chunk_offset) const;
-    vector<vcflib::Variant> vars = { var };
-    vg::Constructor constructor;
-    constructor.flat = true;
-    constructor.trim_indels = false;
-    string graph_ref_seq = fasta_ref.getSubSequence(seq_name, graph_begin_pos, graph_end_pos-graph_begin_pos);
-    vg::ConstructedChunk chunk = constructor.construct_chunk(graph_ref_seq, var.sequenceName,
-                                                             vars, graph_begin_pos);
-    vg::VG graph; graph.merge(chunk.graph);
-    if (max_node_size > 0) {
-        graph.dice_nodes(max_node_size); // force nodes to be 1bp
-    }
-    graph.compact_ids();
-    int head_tail_id = 100;
-    for (auto& n : graph.head_nodes()) {
-        graph.swap_node_id(n, head_tail_id++);
-    }
-    for (auto& n : graph.tail_nodes()) {
-        graph.swap_node_id(n, head_tail_id++);
-    }
-    // now set the ids of the ref and alts to keep sort invariance
-    map<string, int> allele_seq_to_id;
-    {
-        int k = 0;
-        for (auto& a : var.alleles) {
-            allele_seq_to_id[a] = ++k;
+    // without graph features, it stays empty
+    clock.enter(STAGE_GRAPH_BUILD);
+    vg::VG graph;
+    set<vg::id_t> allele_nodes;
+    if (use_graph) {
+        vector<vcflib::Variant> vars = { var };
+        vg::Constructor constructor;
+        constructor.flat = true;
+        constructor.trim_indels = false;
+        string graph_ref_seq = ref_subsequence(seq_name, graph_begin_pos, graph_end_pos-graph_begin_pos);
+        vg::ConstructedChunk chunk = constructor.construct_chunk(graph_ref_seq, var.sequenceName,
+                                                                 vars, graph_begin_pos);
+        graph.merge(chunk.graph);
+        if (options.max_node_size > 0) {
+            graph.dice_nodes(options.max_node_size); // force nodes to be 1bp
+        }
+        graph.compact_ids();
+        int head_tail_id = 100;
+        for (auto& n : graph.head_nodes()) {
+            graph.swap_node_id(n, head_tail_id++);
+        }
+        for (auto& n : graph.tail_nodes()) {
+            graph.swap_node_id(n, head_tail_id++);
+        }
+        // now set the ids of the ref and alts to keep sort invariance
+        map<string, int> allele_seq_to_id;
+        {
+            int k = 0;
+            for (auto& a : var.alleles) {
+                allele_seq_to_id[a] = ++k;
+            }
         }
-    }
 
-    set<vg::id_t> allele_nodes;
-    /// todo ... switch k to use fraction mapping to each allele
-    graph.for_each_node([&](vg::Node* n) {
-            if (!graph.is_head_node(n)
-                && !graph.is_tail_node(n)) {
-                // find out which allele it is
-                // we're using a literal graphification of the VCF here due to options to vg construction
-                // so we should be able to map from non-head, non-tail node to VCF allele
-                auto f = allele_seq_to_id.find(n->sequence());
-                if (f == allele_seq_to_id.end()) {
-                    cerr << "could not find allele sequence for " << pb2json(*n) << endl;
-                    cerr << var << endl;
-                } else {
-                    graph.swap_node_id(n, f->second + 200);
-                    allele_nodes.insert(f->second + 200);
+        /// todo ... switch k to use fraction mapping to each allele
+        graph.for_each_node([&](vg::Node* n) {
+                if (!graph.is_head_node(n)
+                    && !graph.is_tail_node(n)) {
+                    // find out which allele it is
+                    // we're using a literal graphification of the VCF here due to options to vg construction
+                    // so we should be able to map from non-head, non-tail node to VCF allele
+                    auto f = allele_seq_to_id.find(n->sequence());
+                    if (f == allele_seq_to_id.end()) {
+                        cerr << "could not find allele sequence for " << pb2json(*n) << endl;
+                        cerr << var << endl;
+                    } else {
+                        graph.swap_node_id(n, f->second + 200);
+                        allele_nodes.insert(f->second + 200);
+                    }
                 }
-            }
-        });
-    
-    graph.rebuild_indexes();
+            });
+
+        graph.rebuild_indexes();
+    }
+    // built the first time a read is aligned with --bubble-align
+    unique_ptr<BubbleAligner> bubble;
     //graph.serialize_to_file("graphs/"+target+ ".vg");
     graph.for_each_node([&](vg::Node* n) {
             graph_coverage[n->id()] = 0;
@@ -614,69 +675,115 @@ HHGA::HHGA(size_t window_length,
     long int lowestReferenceBase = 0;
     long unsigned int referenceBases = 0;
     unsigned int currentRefSeqID = 0;
-    bool biallelic_snp = var.alleles.size() == 2 && var.ref.size() == 1 && var.alleles.back().size() == 1;
-    bool use_repeat_window = min_repeat_entropy && !biallelic_snp;
 
-    // set up our readers
-    set_region(bam_reader, seq_name, begin_pos, end_pos);
-    // get the alignments at the locus
-    // aligning them to the graph
-    BamTools::BamAlignment aln;
-    while (bam_reader.GetNextAlignment(aln)) {
-        if (aln.IsMapped()) {
-            if (!use_repeat_window) {
-                alignments.push_back(aln);
-            } else if (aln.Position <= callable_begin_pos
-                       && aln.GetEndPosition() > callable_end_pos) {
-                alignments.push_back(aln);
+    clock.enter(STAGE_FETCH);
+    // read from the sorted sweep when we have one, or seek to each window
+    auto for_each_alignment = [&](BamTools::BamMultiReader& reader,
+                                  SweepReader* sweep,
+                                  int32_t region_begin,
+                                  int32_t region_end,
+                                  const function<void(BamTools::BamAlignment&)>& lambda) {
+        if (sweep) {
+            sweep->for_each_overlap(region_begin, region_end, lambda);
+        } else {
+            set_region(reader, seq_name, region_begin, region_end);
+            BamTools::BamAlignment aln;
+            while (reader.GetNextAlignment(aln)) {
+                lambda(aln);
             }
         }
-    }
+    };
+    // alignments behind both the window and the graph window are no longer needed
+    if (bam_sweep) bam_sweep->advance(seq_name, min(begin_pos, (int32_t)graph_begin_pos));
+    if (unitig_sweep) unitig_sweep->advance(seq_name, begin_pos);
+
+    // get the alignments at the locus
+    // with --downsample, they wait in a reservoir until the region is read
+    ReadSampler sampler(options.sample_depth, options.sample_seed);
+    size_t reads_fetched = 0;
+    for_each_alignment(in.bam_reader, bam_sweep, begin_pos, end_pos,
+                       [&](BamTools::BamAlignment& aln) {
+            ++reads_fetched;
+            if (aln.IsMapped()) {
+                if (!use_repeat_window
+                    || (aln.Position <= callable_begin_pos
+                        && aln.GetEndPosition() > callable_end_pos)) {
+                    if (options.sample_depth) {
+                        sampler.add(aln);
+                    } else {
+                        alignments.push_back(aln);
+                        is_unitig.push_back(false);
+                    }
+                }
+            }
+        });
+    sampler.for_each([&](BamTools::BamAlignment& aln) {
+            alignments.push_back(aln);
+            is_unitig.push_back(false);
+        });
 
     // now handle the graph region, which can be bigger
-    set_region(bam_reader, seq_name, graph_begin_pos, graph_end_pos);
-    //stringstream t; t << "graphs/" << target << ".reads";
-    //ofstream oalns(t.str());
-    while (bam_reader.GetNextAlignment(aln)) {
-        auto vgaln = graph.align(aln.QueryBases);
-        vgaln.set_quality(aln.Qualities);
-        graph_alns.push_back(vgaln);
-        //oalns << aln.QueryBases << endl;
+    // aligning the reads to the graph and compressing the alignments into it as we go
+    graph_alignment_count = 0;
+    if (count_graph_reads) {
+        // every read is counted, but only the sampled ones are aligned
+        ReadSampler graph_sampler(options.sample_depth, options.sample_seed);
+        auto align_to_graph = [&](BamTools::BamAlignment& aln) {
+            if (options.bubble_align) {
+                if (!bubble) bubble.reset(new BubbleAligner(graph));
+                bubble->align(aln.QueryBases, aln.Qualities,
+                                                   [&](vg::id_t node, int qual) {
+                        graph_coverage[node]++;
+                        graph_weights[node] += (double)qual;
+                    });
+                return;
+            }
+            auto vgaln = graph.align(aln.QueryBases);
+            vgaln.set_quality(aln.Qualities);
+            auto& path = vgaln.path();
+            for (int i = 0; i < path.mapping_size(); ++i) {
+                auto mapping = path.mapping(i);
+                graph_coverage[mapping.position().node_id()]++;
+            }
+            auto qual_per_node = alignment_quality_per_node(vgaln);
+            for (auto& n : qual_per_node) {
+                graph_weights[n.first] += (double)n.second;
+            }
+        };
+        for_each_alignment(in.bam_reader, bam_sweep, graph_begin_pos, graph_end_pos,
+                           [&](BamTools::BamAlignment& aln) {
+                ++graph_alignment_count;
+                if (!use_graph) {
+                    return;
+                } else if (options.sample_depth) {
+                    graph_sampler.add(aln);
+                } else {
+                    clock.enter(STAGE_GRAPH_ALIGN);
+                    align_to_graph(aln);
+                    clock.enter(STAGE_FETCH);
+                }
+            });
+        clock.enter(STAGE_GRAPH_ALIGN);
+        graph_sampler.for_each(align_to_graph);
+        clock.enter(STAGE_FETCH);
     }
-    //oalns.close();
 
     // handle the unitigs
-    set_region(unitig_reader, seq_name, begin_pos, end_pos);
-    //BamTools::BamAlignment aln;
     int unitig_count = 0;
-    while (unitig_reader.GetNextAlignment(aln)) {
-        if (aln.IsMapped()) {
-            if (!use_repeat_window) {
-                alignments.push_back(aln);
-                ++unitig_count;
-                unitigs.insert(&alignments.back());
-            } else if (aln.Position <= callable_begin_pos
-                       && aln.GetEndPosition() > callable_end_pos) {
-                alignments.push_back(aln);
-                ++unitig_count;
-                unitigs.insert(&alignments.back());
+    for_each_alignment(in.unitig_reader, unitig_sweep, begin_pos, end_pos,
+                       [&](BamTools::BamAlignment& aln) {
+            if (aln.IsMapped()) {
+                if (!use_repeat_window
+                    || (aln.Position <= callable_begin_pos
+                        && aln.GetEndPosition() > callable_end_pos)) {
+                    alignments.push_back(aln);
+                    is_unitig.push_back(true);
+                    ++unitig_count;
+                }
             }
-        }
-    }
-
-    // compress the alignment information into the graph
-    for (auto& vgaln : graph_alns) {
-        auto& path = vgaln.path();
-        for (int i = 0; i < path.mapping_size(); ++i) {
-            auto mapping = path.mapping(i);
-            graph_coverage[mapping.position().node_id()]++;
-        }
-        auto qual_per_node = alignment_quality_per_node(vgaln);
-        for (auto& n : qual_per_node) {
-            graph_weights[n.first] += (double)n.second;
-        }
-    }
+        });
 
+    clock.enter(STAGE_DECODE);
     double mapping_to_alleles = 0;
     for (auto& c : graph_coverage) {
         if (allele_nodes.count(c.first)) {
@@ -698,7 +805,12 @@ HHGA::HHGA(size_t window_length,
     int32_t min_pos = alignments.front().Position;
     int32_t max_pos = min_pos;
 
-    for (auto& aln : alignments) {
+    size_t read_count = alignments.size();
+    alignment_alleles.resize(read_count);
+    read_positions.resize(read_count);
+    for (size_t r = 0; r < read_count; ++r) {
+        auto& aln = alignments[r];
+        read_positions[r] = aln.Position;
         //cerr << "on alignment " << aln.Name << endl;
         int32_t endpos = aln.GetEndPosition();
 
@@ -707,59 +819,123 @@ HHGA::HHGA(size_t window_length,
         // iterate through the alignment
         // converting it into a series of alleles
 
-        // record the qualities
-        vector<prob_t> quals;
+        // only alleles from one base before the window through one base after it
+        // can reach the MSA, the flanks keep the gap and missing padding of each
+        // row and the filter's marks the same as if the whole read were decoded
+        int32_t decode_begin = begin_pos - 1;
+        int32_t decode_end = end_pos + 1;
+        // pad_alleles renumbers each row consecutively from its first allele,
+        // so skipping the read's head is only safe while its alleles run in order
+        // a skipped region (N), or a leading soft clip placed at or past the read start,
+        // breaks that order, and those reads are decoded whole
+        bool windowed = aln.Position < decode_end && endpos > decode_begin;
+        bool aligned = false;
+        for (auto& op : aln.CigarData) {
+            if (op.Type == 'N') {
+                windowed = false;
+            } else if (op.Type == 'S' && !aligned) {
+                // see the 'S' case below for where clips are placed
+                if (&op != &aln.CigarData.front() || ref_count >= 2) windowed = false;
+            } else if (op.Type != 'H') {
+                aligned = true;
+            }
+        }
+        if (!windowed) {
+            decode_begin = min(aln.Position, decode_begin);
+            decode_end = max(endpos + 1, decode_end);
+        }
+
+        // record the qualities, converting only those the window uses
+        vector<prob_t> quals(aln.Qualities.size());
         assert(aln.Qualities.size() == aln.QueryBases.size());
-        for (string::iterator c = aln.Qualities.begin(); c != aln.Qualities.end(); ++c) {
+        size_t quals_begin = 0;
+        size_t quals_end = 0;
+        auto convert_qual = [&](size_t k) {
+            char c = aln.Qualities[k];
             if (exponentiate) {
-                quals.push_back(
-                    1-phred2float(
-                        qualityChar2ShortInt(*c)));
+                quals[k] = 1-phred2float(qualityChar2ShortInt(c));
             } else {
-                quals.push_back(
-                    qualityChar2ShortInt(*c));
+                quals[k] = qualityChar2ShortInt(c);
             }
-        }
-
-        string refseq = fasta_ref.getSubSequence(referenceIDToName[aln.RefID],
-                                                 aln.Position,
-                                                 aln.GetEndPosition() - (aln.Position - 1));
+        };
+        auto need_quals = [&](int from, int to) {
+            from = max(from, 0);
+            to = min(to, (int)quals.size());
+            if (from >= to) return;
+            if (quals_begin == quals_end) quals_begin = quals_end = from;
+            while ((int)quals_begin > from) convert_qual(--quals_begin);
+            while ((int)quals_end < to) convert_qual(quals_end++);
+        };
+
+        // with the cache we read bases in place rather than copying the read's span
+        // either way only the part of the span being decoded is fetched
+        int32_t ref_offset = max(decode_begin - aln.Position, 0);
+        int32_t ref_length = min(endpos + 1, decode_end) - (aln.Position + ref_offset);
+        string refseq;
+        ref_view_t refview;
+        if (ref_cache) {
+            refview = ref_cache->view(referenceIDToName[aln.RefID],
+                                      aln.Position + ref_offset,
+                                      ref_length);
+        } else {
+            refseq = in.fasta_ref.getSubSequence(referenceIDToName[aln.RefID],
+                                              aln.Position + ref_offset,
+                                              ref_length);
+        }
+        auto ref_base = [&](size_t p) -> allele_code_t {
+            p -= ref_offset;
+            if (ref_cache) {
+                return p < refview.size() ? (unsigned char) refview[p] : ALLELE_EMPTY;
+            } else {
+                return p < refseq.size() ? (unsigned char) refseq[p] : ALLELE_EMPTY;
+            }
+        };
         const string& readseq = aln.QueryBases;
         int rel_pos = aln.Position - this->begin_pos;
 
         int rp = 0; int sp = 0;
 
-        vector<allele_t>& aln_alleles = alignment_alleles[&aln];
+        alleles_t& aln_alleles = alignment_alleles[r];
 
         vector<BamTools::CigarOp>::const_iterator cigarIter = aln.CigarData.begin();
         vector<BamTools::CigarOp>::const_iterator cigarEnd  = aln.CigarData.end();
         for ( ; cigarIter != cigarEnd; ++cigarIter ) {
             unsigned int len = cigarIter->Length;
-            char t = cigarIter->Type;        
+            char t = cigarIter->Type;
+            // the part of a reference-consuming op that is decoded
+            int32_t op_pos = rp + aln.Position;
+            int first = min(max(decode_begin - op_pos, 0), (int)len);
+            int last = max(min(decode_end - op_pos, (int)len), first);
             switch (t) {
             case 'I':
             {
-                auto iprobs = insertion_probs(quals, sp, len);
-                for (int i = 0; i < len; ++i) {
-                    aln_alleles.push_back(
-                        allele_t("U",
-                                 readseq.substr(sp + i, 1),
-                                 rp + aln.Position-1,
-                                 iprobs[i]));
+                if (op_pos-1 >= decode_begin && op_pos-1 < decode_end) {
+                    need_quals(sp - (len + 2), sp + (len + 2));
+                    auto iprobs = insertion_probs(quals, sp, len);
+                    for (int i = 0; i < len; ++i) {
+                        aln_alleles.push_back(
+                            allele_t('U',
+                                     (unsigned char) readseq[sp + i],
+                                     rp + aln.Position-1,
+                                     iprobs[i]));
 
+                    }
                 }
                 sp += len;
             }
             break;
             case 'D':
             {
-                auto dprobs = deletion_probs(quals, sp, len);
-                for (int i = 0; i < len; ++i) {
+                if (first < last) {
+                    need_quals(sp - (len + 2), sp + (len + 2));
+                    auto dprobs = deletion_probs(quals, sp, len);
+                    for (int i = first; i < last; ++i) {
                         aln_alleles.push_back(
-                            allele_t(refseq.substr(rp + i, 1),
-                                     "U",
+                            allele_t(ref_base(rp + i),
+                                     'U',
                                      rp + i + aln.Position,
                                      dprobs[i]));
+                    }
                 }
                 rp += len;
             }
@@ -767,10 +943,11 @@ HHGA::HHGA(size_t window_length,
             case 'X':
             case 'M':
             {
-                for (int i = 0; i < len; ++i) {
+                need_quals(sp + first, sp + last);
+                for (int i = first; i < last; ++i) {
                     aln_alleles.push_back(
-                        allele_t(refseq.substr(rp + i, 1),
-                                 readseq.substr(sp + i, 1),
+                        allele_t(ref_base(rp + i),
+                                 (unsigned char) readseq[sp + i],
                                  rp + i + aln.Position,
                                  quals[sp+i]));
                 }
@@ -782,9 +959,9 @@ HHGA::HHGA(size_t window_length,
                 // position is -1 if at the beginning
                 // or +1 if at the end
                 if (cigarIter == aln.CigarData.begin()) {
-                    aln_alleles.push_back(allele_t("", "S", rp + i + aln.Position-2, len));
+                    aln_alleles.push_back(allele_t(ALLELE_EMPTY, 'S', rp + ref_count + aln.Position-2, len));
                 } else {
-                    aln_alleles.push_back(allele_t("", "S", rp + i + aln.Position+2, len));
+                    aln_alleles.push_back(allele_t(ALLELE_EMPTY, 'S', rp + ref_count + aln.Position+2, len));
                 }
                 sp += len;
                 break;
@@ -801,14 +978,17 @@ HHGA::HHGA(size_t window_length,
         }
     }
 
+    clock.enter(STAGE_MSA);
     // make the reference haplotype
-    for (size_t i = 0; i < window_length; ++i) {
-        string base = window_ref_seq.substr(i, 1);
-        reference.push_back(allele_t(base, base, begin_pos + i, 1));
+    // the reference, haps and genotypes are copied into the MSA once they are padded
+    alleles_t ref_alleles;
+    for (size_t i = 0; i < options.window_length; ++i) {
+        allele_code_t base = i < window_ref_seq.size() ? (unsigned char) window_ref_seq[i] : ALLELE_EMPTY;
+        ref_alleles.push_back(allele_t(base, base, begin_pos + i, 1));
     }
 
     // make each alt into a haplotype
-    map<string, vector<allele_t> > vhaps;
+    site_map<string, alleles_t> vhaps;
     /*
     auto& vref = vhaps[var.ref];
     for (size_t i = 0; i < var.ref.size(); ++i) {
@@ -831,8 +1011,8 @@ HHGA::HHGA(size_t window_length,
             if (a.ref == a.alt && a.alt.size() > 1) {
                 // break it apart
                 for (size_t i = 0; i < a.ref.size(); ++i) {
-                    valleles.push_back(allele_t(a.ref.substr(i,1),
-                                                a.alt.substr(i,1),
+                    valleles.push_back(allele_t((unsigned char) a.ref[i],
+                                                (unsigned char) a.alt[i],
                                                 a.position+i-1, 1));
                 }
             } else {
@@ -840,28 +1020,28 @@ HHGA::HHGA(size_t window_length,
                 if (a.ref.empty()) {
                     has_insertion = true;
                     for (size_t i = 0; i < a.alt.size(); ++i) {
-                        valleles.push_back(allele_t("U",
-                                                    a.alt.substr(i,1),
+                        valleles.push_back(allele_t('U',
+                                                    (unsigned char) a.alt[i],
                                                     a.position-2, 1));
                     }
                 } else if (a.alt.empty()) {
                     has_deletion = true;
                     // deletions get broken into individual bases
                     for (size_t i = 0; i < a.ref.size(); ++i) {
-                        valleles.push_back(allele_t(a.ref.substr(i,1),
-                                                    "U",
+                        valleles.push_back(allele_t((unsigned char) a.ref[i],
+                                                    'U',
                                                     a.position+i-1, 1));
                     }
                 } else {
-                    valleles.push_back(allele_t(a.ref,
-                                                a.alt,
+                    valleles.push_back(allele_t(allele_seqs.encode(a.ref),
+                                                allele_seqs.encode(a.alt),
                                                 a.position-1, 1));
                 }
             }
         }
         while (valleles.size() < max_haplotype_length) {
-            valleles.push_back(allele_t("",
-                                        "U",
+            valleles.push_back(allele_t(ALLELE_EMPTY,
+                                        'U',
                                         valleles.back().position,
                                         1));
         }
@@ -870,7 +1050,7 @@ HHGA::HHGA(size_t window_length,
     // normalize away the VCF funk
     // by removing any reference-matching bases
     if (has_insertion || has_deletion) {
-        set<string> first_bases;
+        set<allele_code_t> first_bases;
         for (auto& v : vhaps) {
             auto& valleles = v.second;
             first_bases.insert(valleles[0].alt);
@@ -878,7 +1058,7 @@ HHGA::HHGA(size_t window_length,
         if (first_bases.size() == 1) {
             for (auto& v : vhaps) {
                 auto& valleles = v.second;
-                valleles.front().alt = "M";
+                valleles.front().alt = 'M';
             }
             // TODO it might be nice to re-center
             // but i'm not sure the right way to do it for insertions and deletions
@@ -888,11 +1068,13 @@ HHGA::HHGA(size_t window_length,
     // for each sample
     // get the genotype
     vector<string> haplotype_seqs;
+    site_vector<alleles_t> hap_alleles;
     for (auto& allele : var.alleles) {
-        haplotypes.push_back(vhaps[allele]);
+        hap_alleles.push_back(vhaps[allele]);
         haplotype_seqs.push_back(allele);
     }
     vector<string> genotype_seqs;
+    site_vector<alleles_t> geno_alleles;
     int sid = 0; int gid = 0;
     for (auto& s : var.samples) {
         ++sid;
@@ -901,7 +1083,7 @@ HHGA::HHGA(size_t window_length,
         for (auto& g : gt) {
             if (g.first != vcflib::NULL_ALLELE) {
                 for (size_t i = 0; i < g.second; ++i){
-                    genotypes.push_back(vhaps[var.alleles[g.first]]);
+                    geno_alleles.push_back(vhaps[var.alleles[g.first]]);
                     sample_id[gid++] = sid;
                     genotype_seqs.push_back(var.alleles[g.first]);
                 }
@@ -910,54 +1092,54 @@ HHGA::HHGA(size_t window_length,
     }
 
     // for all the info fields
-    for (auto& f : var.info) {
-        // what kind of field is this?
-        auto field_name = f.first;
-        auto field_type = var.infoType(field_name);
-        auto& fields = f.second;
-        int i = 0;
-        for (auto& field : fields) {
-            ++i;
-            stringstream k;
-            k << input_name << field_name << "_" << i;
-            string key = k.str();
-            try {
-                if (field_type == vcflib::FIELD_FLOAT
-                    || field_type == vcflib::FIELD_INTEGER) {
-                    call_info_num[key] = stod(field);
-                } else if (field_type == vcflib::FIELD_BOOL
-                           || field_type == vcflib::FIELD_STRING) {
-                    call_info_str[key] = field;
+    if (features & FEATURE_SOFTWARE) {
+        for (auto& f : var.info) {
+            // what kind of field is this?
+            auto field_name = f.first;
+            auto field_type = var.infoType(field_name);
+            auto& fields = f.second;
+            int i = 0;
+            for (auto& field : fields) {
+                ++i;
+                stringstream k;
+                k << options.input_name << field_name << "_" << i;
+                string key = k.str();
+                try {
+                    if (field_type == vcflib::FIELD_FLOAT
+                        || field_type == vcflib::FIELD_INTEGER) {
+                        call_info_num[key] = stod(field);
+                    } else if (field_type == vcflib::FIELD_BOOL
+                               || field_type == vcflib::FIELD_STRING) {
+                        call_info_str[key] = field;
+                    }
+                } catch (...) {
+                    // do nothing if the field is invalid
+                    // wtf -- only VCF would be impossible to get right
                 }
-            } catch (...) {
-                // do nothing if the field is invalid
-                // wtf -- only VCF would be impossible to get right
             }
         }
     }
 
     // do the same for QUAL
-    call_info_num[input_name + "QUAL"] = var.quality;
+    call_info_num[options.input_name + "QUAL"] = var.quality;
 
     // find alleles above a threshold rate of incidence
-    for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-        vector<allele_t>& aln_alleles = a->second;
-        map<int, int> pos_count;
+    for (auto& aln_alleles : alignment_alleles) {
+        site_map<int, int> pos_count;
         for (auto& allele : aln_alleles) {
-            allele_counts[allele.str()][pos_count[allele.position]++]++;
+            allele_counts[allele_key(allele)][pos_count[allele.position]++]++;
         }
     }
 
     // keep only those alleles > our threshold
-    for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-        vector<allele_t>& aln_alleles = a->second;
-        vector<allele_t> filtered_alleles;
+    for (auto& aln_alleles : alignment_alleles) {
+        alleles_t filtered_alleles;
         int last_pos = 0;
-        map<int, int> pos_count;
+        site_map<int, int> pos_count;
         for (auto& allele : aln_alleles) {
-            if (allele_counts[allele.str()][pos_count[allele.position]++] < min_allele_count) {
+            if (allele_counts[allele_key(allele)][pos_count[allele.position]++] < options.min_allele_count) {
                 if (last_pos && last_pos != allele.position) {
-                    filtered_alleles.push_back(allele_t("", "M", allele.position, 1));
+                    filtered_alleles.push_back(allele_t(ALLELE_EMPTY, 'M', allele.position, 1));
                 }
             } else {
                 filtered_alleles.push_back(allele);
@@ -967,13 +1149,12 @@ HHGA::HHGA(size_t window_length,
         aln_alleles = filtered_alleles;
     }
 
-    map<int32_t, size_t> pos_max_length;
+    site_map<int32_t, size_t> pos_max_length;
 
     
     // trim the reads to the right size and determine the maximum indel length at each reference position
-    for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-        vector<allele_t>& aln_alleles = a->second;
-        map<int32_t, size_t> pos_counts;
+    for (auto& aln_alleles : alignment_alleles) {
+        site_map<int32_t, size_t> pos_counts;
         for (auto& allele : aln_alleles) {
             ++pos_counts[allele.position];
         }
@@ -985,7 +1166,7 @@ HHGA::HHGA(size_t window_length,
 
     // do for the alternate haps too
     for (auto& v : vhaps) {
-        map<int32_t, size_t> pos_counts;
+        site_map<int32_t, size_t> pos_counts;
         for (auto& allele : v.second) {
             ++pos_counts[allele.position];
         }
@@ -998,7 +1179,7 @@ HHGA::HHGA(size_t window_length,
     // maps position/indels into offsets
     // pair<i, 0> -> reference
     // pari<i, j> -> jth insertion after base
-    map<pair<int32_t, size_t>, size_t> pos_proj;
+    site_map<pair<int32_t, size_t>, size_t> pos_proj;
     size_t j = 0;
     for (auto p : pos_max_length) {
         int32_t pos = p.first;
@@ -1016,16 +1197,16 @@ HHGA::HHGA(size_t window_length,
     */
 
     // convert positions into the new frame
-    for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-        project_positions(a->second, pos_proj);
+    for (auto& aln_alleles : alignment_alleles) {
+        if (!aln_alleles.empty()) project_positions(aln_alleles, pos_proj);
     }
     // same for ref
-    project_positions(reference, pos_proj);
+    project_positions(ref_alleles, pos_proj);
     // and genotype/haps
-    for (auto& hap : haplotypes) {
+    for (auto& hap : hap_alleles) {
         project_positions(hap, pos_proj);
     }
-    for (auto& hap : genotypes) {
+    for (auto& hap : geno_alleles) {
         project_positions(hap, pos_proj);
     }
 
@@ -1038,31 +1219,37 @@ HHGA::HHGA(size_t window_length,
     // where is the new center
     pos_t center = pos_proj[make_pair(center_pos, 0)];// + shift_center;
     //cerr << "center is " << center << endl;
-    pos_t bal_min = max(center - window_length/2, (size_t)0);
-    pos_t bal_max = bal_min + window_length;
+    pos_t bal_min = max(center - options.window_length/2, (size_t)0);
+    pos_t bal_max = bal_min + options.window_length;
 
     // re-center
     // re-strip out our limits
     // add the missing bases
     // add the gap bases
-    vector<alignment_t*> to_erase;
-    for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-        //cerr << a->first->Name << endl;
-        a->second = pad_alleles(a->second, bal_min, bal_max);
-        if (a->second.empty()) to_erase.push_back(a->first);
+    // reads left empty are outside the window, and are skipped from here on
+    read_row_offset = 1 + hap_alleles.size() + geno_alleles.size();
+    msa.reset(read_row_offset + read_count, options.window_length);
+    size_t row = 0;
+    pad_alleles(ref_alleles, bal_min, bal_max, row++);
+    for (auto& hap : hap_alleles) {
+        pad_alleles(hap, bal_min, bal_max, row++);
     }
-    for (auto e : to_erase) alignment_alleles.erase(e);
-
-    reference = pad_alleles(reference, bal_min, bal_max);
-    
-    for (auto& hap : haplotypes) {
-        hap = pad_alleles(hap, bal_min, bal_max);
+    for (auto& hap : geno_alleles) {
+        pad_alleles(hap, bal_min, bal_max, row++);
     }
-    for (auto& hap : genotypes) {
-        hap = pad_alleles(hap, bal_min, bal_max);
+    for (auto& aln_alleles : alignment_alleles) {
+        pad_alleles(aln_alleles, bal_min, bal_max, row++);
+    }
+    row = 0;
+    reference = msa.row(row++);
+    for (size_t i = 0; i < hap_alleles.size(); ++i) {
+        haplotypes.push_back(msa.row(row++));
+    }
+    for (size_t i = 0; i < geno_alleles.size(); ++i) {
+        genotypes.push_back(msa.row(row++));
     }
 
-    if (assume_ref) {
+    if (options.assume_ref) {
         // determine limits
         // and pad within them
         missing_to_ref(haplotypes);
@@ -1070,9 +1257,9 @@ HHGA::HHGA(size_t window_length,
     }
 
     // optionally force the reference matching alleles to be R
-    if (!show_bases) {
-        for (auto a = alignment_alleles.begin(); a != alignment_alleles.end(); ++a) {
-            flatten_to_ref(a->second);
+    if (!options.show_bases) {
+        for (size_t r = 0; r < read_count; ++r) {
+            flatten_to_ref(read_row(r));
         }
         for (auto& hap : haplotypes) {
             flatten_to_ref(hap);
@@ -1082,91 +1269,93 @@ HHGA::HHGA(size_t window_length,
         }
     }
 
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        auto h = alignment_alleles[&aln];
-        missing_counts[&aln] = missing_count(h);
+    // a read is skipped when it misses the window, or doesn't span it under full_overlap
+    missing_counts.resize(read_count);
+    for (size_t r = 0; r < read_count; ++r) {
+        missing_counts[r] = missing_count(read_row(r));
     }
-    
+    auto skip_read = [&](size_t r) {
+        return read_row(r).empty()
+            || (options.full_overlap && missing_counts[r] > 0);
+    };
+
     alignment_count = 0;
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
+    for (size_t r = 0; r < read_count; ++r) {
+        if (skip_read(r)) continue;
         ++alignment_count;
     }
 
-    // establish the allele/hap/ref matches
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
-        int i = 0;
-        auto& weight = matches[&aln];
-        for (auto& hap : haplotypes) {
-            weight[i] = pairwise_identity(
-                alignment_alleles[&aln],
-                hap);
-            ++i;
-        }
-    }
+    size_t hap_count = haplotypes.size();
+    match_width = hap_count;
 
-    // sum up the quality support for the allele/hap/ref matches
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
-        int i = 0;
-        auto& weight = qualsum[&aln];
-        for (auto& hap : haplotypes) {
-            weight[i] = pairwise_qualsum(
-                alignment_alleles[&aln],
-                hap);
-            ++i;
-        }
-    }
-
-    for (int i = 1; i <= 7; ++i) {
-        likelihoods[i] = 1;
-    }
-
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
-        int i = 0;
-        auto& prob = prob_aln_given_genotype[&aln];
+    // establish the allele/hap/ref matches
+    // and sum up the quality support for them
+    clock.enter(STAGE_MATCH);
+    msa.pack();
+    matches.assign(read_count * match_width, 0);
+    qualsum.assign(read_count * match_width, 0);
+    for (size_t r = 0; r < read_count; ++r) {
+        if (skip_read(r)) continue;
+        double* weight = &matches[r * match_width];
+        double* qweight = &qualsum[r * match_width];
+        for (size_t i = 0; i < hap_count; ++i) {
+            // the haplotypes follow the reference row
+            msa.match(read_row_offset + r, 1 + i, weight[i], qweight[i]);
+        }
+    }
+
+    // the genotypes of the site's alleles, in colex order, so those of any fewer alleles come first
+    // each keeps the label it has in all_genotypes
+    int ploidy = all_genotypes.front().size();
+    genotype_count = min((size_t)hhga::genotype_count(hap_count, ploidy), all_genotypes.size());
+    vector<vector<int> > site_genotypes(genotype_count);
+    genotype_labels.resize(genotype_count);
+    for (size_t i = 0; i < genotype_count; ++i) {
+        site_genotypes[i] = genotype_at(i, ploidy);
+        genotype_labels[i] = label_for_genotype(site_genotypes[i], all_genotypes);
+    }
+
+    clock.enter(STAGE_LIKELIHOOD);
+    prob_aln_given_genotype.assign(read_count * genotype_count, 0);
+    likelihoods.assign(genotype_count, 0);
+    if (features & FEATURE_LIKELIHOOD) {
+        // the chance that each read's agreement with a haplotype is an error
+        // reads we skip have no matches, and so support no genotype
+        site_vector<double> match_error(read_count * match_width);
+        for (size_t i = 0; i < match_error.size(); ++i) {
+            match_error[i] = phred2float(qualsum[i]);
+        }
+        site_vector<double> log_likelihoods(genotype_count);
         // for all possible genotype
         // estimate prob(aln | gentoype)
-        bool supports_anything = false;
-        for (int i = 1; i <= 7; ++i) {
-            prob[i] = prob_aln_gt(&aln, i);
-            if (prob[i] > 0) supports_anything = true;
-        }
-        if (supports_anything) {
-            for (int i = 1; i <= 7; ++i) {
-                likelihoods[i] *= prob[i];
+        hhga::genotype_likelihoods(matches.data(), match_error.data(),
+                                   read_count, match_width,
+                                   site_genotypes, genotype_count,
+                                   prob_aln_given_genotype.data(),
+                                   log_likelihoods.data());
+
+        // scale to the most likely genotype in log space, which can't underflow at depth
+        double maxlikelihood = -INFINITY;
+        for (auto l : log_likelihoods) {
+            maxlikelihood = max(maxlikelihood, l);
+        }
+        if (maxlikelihood > -INFINITY) {
+            for (size_t i = 0; i < genotype_count; ++i) {
+                auto l = exp(log_likelihoods[i] - maxlikelihood);
+                if (l < 1e-3) l = 0;
+                likelihoods[i] = l;
             }
         }
     }
 
-    double maxlikelihood = 0;
-    for (int i = 1; i <= 7; ++i) {
-        //likelihoods[i] = float2phred(1-likelihoods[i]);
-        maxlikelihood = max(maxlikelihood, likelihoods[i]);
-    }
-    if (maxlikelihood > 0) {
-        for (int i = 1; i <= 7; ++i) {
-            //likelihoods[i] = float2phred(1-likelihoods[i]);
-            auto l = likelihoods[i]/maxlikelihood;
-            if (l < 1e-3) l = 0;
-            likelihoods[i] = l;
-        }
-    }
-
-    auto aln_sort = [&](alignment_t* a1, alignment_t* a2) {
+    clock.enter(STAGE_GROUP);
+    auto aln_sort = [&](int a1, int a2) {
         auto m1 = missing_counts[a1];
         auto m2 = missing_counts[a2];
         if (m1 < m2) {
             return true;
         } else if (m1 == m2) {
-            return a1->Position < a2->Position;
+            return read_positions[a1] < read_positions[a2];
         } else {
             return false;
         }
@@ -1174,25 +1363,24 @@ HHGA::HHGA(size_t window_length,
     
     // collect allele supports
     int NONMATCH_ID = -1;
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
+    for (size_t r = 0; r < read_count; ++r) {
+        if (skip_read(r)) continue;
+        const double* weight = &matches[r * match_width];
         // use all the best supports
-        map<double, vector<int> > bests;
-        for (int i = 0; i < haplotypes.size(); ++i) {
-            bests[matches[&aln][i]].push_back(i);
+        site_map<double, site_vector<int> > bests;
+        for (int i = 0; i < hap_count; ++i) {
+            bests[weight[i]].push_back(i);
         }
         if (bests.rbegin()->first) {
             for (auto i : bests.rbegin()->second) {
-                allele_support[i][1-matches[&aln][i]].push_back(&aln);
+                allele_support[i][1-weight[i]].push_back(r);
             }
         } else {
             for (auto i : bests.rbegin()->second) {
-                allele_support[NONMATCH_ID][1-matches[&aln][i]].push_back(&aln);
+                allele_support[NONMATCH_ID][1-weight[i]].push_back(r);
             }
         }
     }
-    int x = 0, y = 0;
     for (auto& supp : allele_support) {
         for (auto& hsup : supp.second) {
             auto& sup = hsup.second;
@@ -1203,20 +1391,18 @@ HHGA::HHGA(size_t window_length,
     }
 
     // collect soft clips
-    //vector<alignment_t*> softclipped;
-    for (auto& aln : alignments) {
-        if (alignment_alleles.find(&aln) == alignment_alleles.end()) continue;
-        if (full_overlap && missing_counts[&aln] > 0) continue;
+    for (size_t r = 0; r < read_count; ++r) {
+        if (skip_read(r)) continue;
         // if we have a softclip
-        if (has_softclip(alignment_alleles[&aln])) {
-            softclipped.push_back(&aln);
+        if (has_softclip(read_row(r))) {
+            softclipped.push_back(r);
         }
     }
     std::sort(softclipped.begin(), softclipped.end(), aln_sort);
     softclipped.erase(std::unique(softclipped.begin(), softclipped.end()),
                       softclipped.end());
-    if (max_depth && softclipped.size() > max_depth) {
-        softclipped.erase(softclipped.begin() + max_depth, softclipped.end());
+    if (options.max_depth && softclipped.size() > options.max_depth) {
+        softclipped.erase(softclipped.begin() + options.max_depth, softclipped.end());
     }
 
     // organize the ordered alignments
@@ -1229,20 +1415,19 @@ HHGA::HHGA(size_t window_length,
             for (auto& aln : sup) {
                 stringstream ss;
                 // we limit ourselves to only 7 alleles, 1 softclip (=9) and 1 degenerate (OB=8)
-                if (unitigs.count(aln)) {
+                if (is_unitig[aln]) {
                     ss << supp.first << "u" << u++;
-                    if (max_depth && u+i > max_depth) break;
+                    if (options.max_depth && u+i > options.max_depth) break;
                 } else {
-                    if (aln->IsReverseStrand()) {
-                        if (max_depth && i >= max_depth) continue;
+                    if (alignments[aln].IsReverseStrand()) {
+                        if (options.max_depth && i >= options.max_depth) continue;
                         ss << supp.first << "-" << i++;
                     } else {
-                        if (max_depth && j >= max_depth) continue;
+                        if (options.max_depth && j >= options.max_depth) continue;
                         ss << supp.first << "+" << j++;
                     }
                 }
-                alignment_groups[aln].push_back(ss.str());
-                if (!unitigs.count(aln)) {
+                if (!is_unitig[aln]) {
                     grouped_normal_alignments.push_back(make_pair(ss.str(), aln));
                 } else {
                     grouped_unitig_alignments.push_back(make_pair(ss.str(), aln));
@@ -1260,17 +1445,16 @@ HHGA::HHGA(size_t window_length,
         for (auto& aln : softclipped) {
             stringstream ss;
             // we keep soft clips in the special namespace 9
-            if (unitigs.count(aln)) {
+            if (is_unitig[aln]) {
                 ss << SOFTCLIP_ID << "u" << u++;
             } else {
-                if (aln->IsReverseStrand()) {
+                if (alignments[aln].IsReverseStrand()) {
                     ss << SOFTCLIP_ID << "-" << i++;
                 } else {
                     ss << SOFTCLIP_ID << "+" << j++;
                 }
             }
-            alignment_groups[aln].push_back(ss.str());
-            if (!unitigs.count(aln)) {
+            if (!is_unitig[aln]) {
                 grouped_normal_alignments.push_back(make_pair(ss.str(), aln));
             } else {
                 grouped_unitig_alignments.push_back(make_pair(ss.str(), aln));
@@ -1286,29 +1470,43 @@ HHGA::HHGA(size_t window_length,
     vrep << join(var.alt, ",");
     repr = vrep.str();
 
+    if (stats) {
+        stats->reads_fetched += reads_fetched;
+        stats->reads_kept += read_count - unitig_count;
+        stats->unitigs += unitig_count;
+        stats->graph_alignments += graph_alignment_count;
+        stats->msa_width = msav_max - msav_min + 1;
+        stats->msa_depth = msa.rows();
+    }
 }
 
-void HHGA::flatten_to_ref(vector<allele_t>& alleles) {
+void HHGA::flatten_to_ref(msa_row_t alleles) {
     for (auto& allele : alleles) {
-        if (allele.alt != "U"
-            && allele.alt != "M"
+        if (allele.alt != 'U'
+            && allele.alt != 'M'
             && allele.alt == allele.ref) {
-            allele.alt = "R";
+            allele.alt = 'R';
         }
     }
 }
 
-void HHGA::strandify(vector<allele_t>& alleles, bool is_rev) {
+void HHGA::strandify(msa_row_t alleles, bool is_rev) {
     if (is_rev) {
         for (auto& allele : alleles) {
             // set to lower case
-            std::transform(allele.alt.begin(), allele.alt.end(), allele.alt.begin(), ::tolower);
+            if (allele.alt < ALLELE_SEQ_BASE) {
+                allele.alt = tolower(allele.alt);
+            } else {
+                string alt = allele_seqs.decode(allele.alt);
+                std::transform(alt.begin(), alt.end(), alt.begin(), ::tolower);
+                allele.alt = allele_seqs.encode(alt);
+            }
         }
     }
 }
 
-void HHGA::project_positions(vector<allele_t>& aln_alleles,
-                             map<pair<int32_t, size_t>, size_t>& pos_proj) {
+void HHGA::project_positions(alleles_t& aln_alleles,
+                             site_map<pair<int32_t, size_t>, size_t>& pos_proj) {
     // adjust the allele positions
     // if the new position is not the same as the last
     // set j = 0
@@ -1321,20 +1519,28 @@ void HHGA::project_positions(vector<allele_t>& aln_alleles,
     }
 }
 
-vector<allele_t> HHGA::pad_alleles(vector<allele_t> aln_alleles,
-                                   pos_t bal_min, pos_t bal_max) {
-    vector<allele_t> padded;
-    if (aln_alleles.empty()) return padded;
+void HHGA::pad_alleles(const alleles_t& aln_alleles,
+                       pos_t bal_min, pos_t bal_max, size_t row) {
+    if (aln_alleles.empty()) return;
 
     // remove the bits outside the window
     pos_t aln_start = aln_alleles.front().position;
     pos_t aln_end = aln_alleles.back().position;
+    if (aln_start > bal_max) return;
+
+    // the padded alleles are renumbered consecutively from the first,
+    // and only those inside the window are written to the row
+    pos_t i = min(bal_min, aln_start);
+    auto put = [&](allele_t allele) {
+        allele.position = i++;
+        if (allele.position >= bal_min && allele.position < bal_max) {
+            msa.push_back(row, allele);
+        }
+    };
 
-    // pad the sides
-    if (aln_start > bal_max) return padded;
     // pad the beginning with "missing" features
     for (int32_t q = bal_min; q < aln_start; ++q) {
-        padded.push_back(allele_t("", "M", q, 1));
+        put(allele_t(ALLELE_EMPTY, 'M', q, 1));
     }
     // pad the gaps
     bool first = true;
@@ -1343,69 +1549,111 @@ vector<allele_t> HHGA::pad_alleles(vector<allele_t> aln_alleles,
         if (!first &&
             last+1 != allele.position) {
             for (int32_t j = 0; j < allele.position - (last + 1); ++j) {
-                padded.push_back(allele_t("", "U", j + last + 1, 1));
+                put(allele_t(ALLELE_EMPTY, 'U', j + last + 1, 1));
             }
         }
         last = allele.position;
-        padded.push_back(allele);
+        put(allele);
         first = false;
     }
     // pad the end with "missing" features
     for (int32_t q = aln_end+1; q < bal_max; ++q) {
-        padded.push_back(allele_t("", "M", q, 1));
+        put(allele_t(ALLELE_EMPTY, 'M', q, 1));
     }
+}
 
-    int i = padded.front().position;
-    for (auto& p : padded) {
-        p.position = i++;
-    }
+void msa_t::reset(size_t rows, size_t width) {
+    col_count = width;
+    cells.assign(rows * width, allele_t(ALLELE_EMPTY, 'M', 0, 1));
+    sizes.assign(rows, 0);
+}
 
-    padded.erase(std::remove_if(padded.begin(), padded.end(),
-                                [&](const allele_t& allele) {
-                                    return allele.position < bal_min || allele.position >= bal_max;
-                                }),
-                      padded.end());
+const allele_t msa_column_t::missing(ALLELE_EMPTY, 'M', 0, 1);
 
-    return padded;
+void msa_t::pack(void) {
+    packed_words = packed_row_words(col_count);
+    packed.assign(rows() * packed_words, 0);
+    match_bits.resize(packed_words);
+    escape_bits.resize(packed_words);
+    for (size_t r = 0; r < rows(); ++r) {
+        uint64_t* words = &packed[r * packed_words];
+        const allele_t* row = &cells[r * col_count];
+        for (size_t i = 0; i < sizes[r]; ++i) {
+            words[i / PACKED_SYMBOLS_PER_WORD] |= (uint64_t)packed_symbol(row[i].alt)
+                << (4 * (i % PACKED_SYMBOLS_PER_WORD));
+        }
+    }
+}
+
+void msa_t::match(size_t r1, size_t r2, double& identity, double& qualsum,
+                  packed_compare_t compare) {
+    size_t possible = compare(&packed[r1 * packed_words],
+                              &packed[r2 * packed_words],
+                              packed_words,
+                              match_bits.data(),
+                              escape_bits.data());
+    const allele_t* h1 = &cells[r1 * col_count];
+    const allele_t* h2 = &cells[r2 * col_count];
+    size_t count = 0;
+    double sum = 0;
+    // walk the matches in order, so the sum rounds as it does in pairwise_qualsum
+    for (size_t w = 0; w < packed_words; ++w) {
+        uint64_t bits = match_bits[w];
+        if (!bits) continue;
+        uint64_t escaped = escape_bits[w];
+        while (bits) {
+            int b = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            size_t i = w * PACKED_SYMBOLS_PER_WORD + b / 4;
+            if (escaped >> b & 1 && h1[i].alt != h2[i].alt) continue;
+            ++count;
+            sum += h1[i].prob;
+        }
+    }
+    identity = possible ? (double) count / (double) possible : 0;
+    qualsum = possible ? sum / (double) possible : 0;
 }
 
 const string HHGA::str(void) {
     //return std::to_string(alleles.size());
-    stringstream out;
+    // formatted as the vw output is, so non-finite values are cleaned up the same way
+    string buffer;
+    vw_writer_t out(buffer);
     //out << std::fixed << std::setprecision(1);
-    out << repr << endl;
+    out << repr << '\n';
     out << "reference          ";
     for (auto& allele : reference) {
-        if (allele.alt == "M") out << " ";
-        else if (allele.alt == "U") out << "-";
-        else if (allele.alt == "R") out << ".";
-        else out << allele.alt;
+        if (allele.alt == 'M') out << " ";
+        else if (allele.alt == 'U') out << "-";
+        else if (allele.alt == 'R') out << ".";
+        else allele_seqs.write(out, allele.alt);
     }
-    out << endl;
+    out << '\n';
     for (auto& hap : haplotypes) {
         out << "hap                ";
         for (auto& allele : hap) {
-            if (allele.alt == "M") out << " ";
-            else if (allele.alt == "U") out << "-";
-            else if (allele.alt == "R") out << ".";
-            else out << allele.alt;
+            if (allele.alt == 'M') out << " ";
+            else if (allele.alt == 'U') out << "-";
+            else if (allele.alt == 'R') out << ".";
+            else allele_seqs.write(out, allele.alt);
         }
-        out << endl;
+        out << '\n';
     }
     for (auto& hap : genotypes) {
         out << "geno               ";
         for (auto& allele : hap) {
-            if (allele.alt == "M") out << " ";
-            else if (allele.alt == "U") out << "-";
-            else if (allele.alt == "R") out << ".";
-            else out << allele.alt;
+            if (allele.alt == 'M') out << " ";
+            else if (allele.alt == 'U') out << "-";
+            else if (allele.alt == 'R') out << ".";
+            else allele_seqs.write(out, allele.alt);
         }
-        out << endl;
+        out << '\n';
     }
 
-    auto do_alignment = [&](alignment_t* aln,
+    auto do_alignment = [&](int r,
                             const string& name,
                             const string& prepend) {
+        auto aln = &alignments[r];
         out << prepend << " ";
         // print out the stuff
         if (aln->IsReverseStrand())     out << "S"; else out << "s";
@@ -1419,33 +1667,33 @@ const string HHGA::str(void) {
         if (aln->IsPrimaryAlignment())  out << "Z"; else out << "z";
         if (aln->IsProperPair())        out << "I"; else out << "i";
         out << "  ";
-        for (auto& allele : alignment_alleles[aln]) {
-            if (allele.alt == "M") out << " ";
-            else if (allele.alt == "U") out << "-";
-            else if (allele.alt == "R") out << ".";
-            else out << allele.alt;
+        for (auto& allele : read_row(r)) {
+            if (allele.alt == 'M') out << " ";
+            else if (allele.alt == 'U') out << "-";
+            else if (allele.alt == 'R') out << ".";
+            else allele_seqs.write(out, allele.alt);
         }
         // the grouping
         out << " " << name;
 
         // now the matches
         out << " : ";
-        for (auto w : matches[aln]) {
-            out << w.second << " ";
+        for (size_t i = 0; i < match_width; ++i) {
+            out << matches[r * match_width + i] << " ";
         }
         out << ": ";
         // now the qualsums
-        for (auto w : qualsum[aln]) {
-            out << w.second << " ";
+        for (size_t i = 0; i < match_width; ++i) {
+            out << qualsum[r * match_width + i] << " ";
         }
         out << ": ";
-        for (auto w : prob_aln_given_genotype[aln]) {
-            out << w.second << " ";
+        for (size_t i = 0; i < genotype_count; ++i) {
+            out << prob_aln_given_genotype[r * genotype_count + i] << " ";
         }
         out << ": ";
         out << aln->MapQuality;
         out << " " << aln->Name;
-        out << endl;
+        out << '\n';
     };
 
     // do the alignment and unitig namespaces
@@ -1478,23 +1726,23 @@ const string HHGA::str(void) {
     }
 
     out << "p(obs|genotype)s ";
-    for (auto& l : likelihoods) {
-        out << l.first << ":" << l.second << " ";
+    for (size_t i = 0; i < genotype_count; ++i) {
+        out << genotype_labels[i] << ":" << likelihoods[i] << " ";
     }
-    out << endl;
+    out << '\n';
 
     out << "graph_coverage ";
     for (auto& w : graph_coverage) {
         out << w.first << "N:" << w.second << " ";
     }
-    out << endl;
+    out << '\n';
 
     /*
     out << "graph_weight ";
     for (auto& w : graph_weights) {
         out << w.first << "N:" << w.second << " ";
     }
-    out << endl;
+    out << '\n';
     */
 
     // now handle caller input features
@@ -1504,159 +1752,199 @@ const string HHGA::str(void) {
     for (auto& f : call_info_str) {
         out << f.first << ":" << f.second << " ";
     }
-    out << endl;
+    out << '\n';
     
-    return out.str();
+    return buffer;
 }
 
 const string HHGA::vw(void) {
-    stringstream out;
+    string buffer;
+    vw(buffer);
+    return buffer;
+}
+
+void HHGA::vw(string& buffer) {
+    vw_writer_t out(buffer);
     // write the class of the example
     out << label << " ";
     out << "'" << repr << " ";
-    // do the ref
-    out << "|ref ";
     size_t idx = 0;
-    for (auto& allele : reference) {
-        out << ++idx << allele.alt << ":" << allele.prob << " ";;
-    }
-    // do the haps
     size_t i = 1;
-    for (auto& hap : haplotypes) {
-        out << "|hap" << i << " ";
-        ++i;
-        idx = 0;
-        for (auto& allele : hap) {
-            if (allele.alt != "M") {
-                out << ++idx << allele.alt << ":" << allele.prob << " ";;
+    if (features & FEATURE_REF) {
+        // do the ref
+        out << "|ref ";
+        for (auto& allele : reference) {
+            out << ++idx;
+            allele_seqs.write(out, allele.alt) << ":" << allele.prob << " ";
+        }
+    }
+    if (features & FEATURE_HAP) {
+        // do the haps
+        for (auto& hap : haplotypes) {
+            out << "|hap" << i << " ";
+            ++i;
+            idx = 0;
+            for (auto& allele : hap) {
+                if (allele.alt != 'M') {
+                    out << ++idx;
+                    allele_seqs.write(out, allele.alt) << ":" << allele.prob << " ";
+                }
             }
         }
     }
     i = 1;
     int gid = 0;
-    for (auto& geno : genotypes) {
-        out << "|geno" << i << " ";
-        ++i;
-        idx = 0;
-        for (auto& allele : geno) {
-            if (allele.alt != "M") {
-                out << ++idx << allele.alt << ":" << allele.prob << " ";
+    if (features & FEATURE_GENO) {
+        for (auto& geno : genotypes) {
+            out << "|geno" << i << " ";
+            ++i;
+            idx = 0;
+            for (auto& allele : geno) {
+                if (allele.alt != 'M') {
+                    out << ++idx;
+                    allele_seqs.write(out, allele.alt) << ":" << allele.prob << " ";
+                }
             }
         }
     }
 
-    // do the row wise alignment features
-    for (auto g : grouped_normal_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        
-        out << "|aln" << name << " ";
-        idx = 0;
-        for (auto& allele : alignment_alleles[aln]) {
-            out << ++idx << allele.alt << ":" << allele.prob << " ";
+    if (features & FEATURE_ALN) {
+        // do the row wise alignment features
+        for (auto g : grouped_normal_alignments) {
+            auto& name = g.first;
+            auto& aln = g.second;
+
+            out << "|aln" << name << " ";
+            idx = 0;
+            for (auto& allele : read_row(aln)) {
+                out << ++idx;
+                allele_seqs.write(out, allele.alt) << ":" << allele.prob << " ";
+            }
         }
     }
 
-    // tranposed into colum wise
-    int coln = 0;
-    for (auto& allele : reference) { //this coud just be the lenght not sure where to get it from
-        out << "|col" << coln << " ";
-        for (auto g : grouped_normal_alignments) {
-            auto&  alle = alignment_alleles[g.second][coln];
-            out << alle.alt << ":" << alle.prob << " ";
+    if (features & FEATURE_COL) {
+        // tranposed into colum wise
+        for (size_t coln = 0; coln < reference.size(); ++coln) {
+            out << "|col" << coln << " ";
+            auto column = msa.column(coln);
+            for (auto g : grouped_normal_alignments) {
+                auto& alle = column[read_row_offset + g.second];
+                allele_seqs.write(out, alle.alt) << ":" << alle.prob << " ";
+            }
         }
-        ++coln;
     }
     
-    for (auto g : grouped_normal_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        out << "|match" << name << " ";
-        // match properties
-        for (auto w : matches[aln]) {
-            out << w.first+1 << "H:" << w.second << " ";
+    if (features & FEATURE_MATCH) {
+        for (auto g : grouped_normal_alignments) {
+            auto& name = g.first;
+            auto& aln = g.second;
+            out << "|match" << name << " ";
+            // match properties
+            for (size_t i = 0; i < match_width; ++i) {
+                out << i+1 << "H:" << matches[aln * match_width + i] << " ";
+            }
         }
     }
 
-    for (auto g : grouped_normal_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        out << "|qual" << name << " ";
-        // match properties
-        for (auto w : qualsum[aln]) {
-            out << w.first+1 << "H:" << w.second << " ";
+    if (features & FEATURE_QUAL) {
+        for (auto g : grouped_normal_alignments) {
+            auto& name = g.first;
+            auto& aln = g.second;
+            out << "|qual" << name << " ";
+            // match properties
+            for (size_t i = 0; i < match_width; ++i) {
+                out << i+1 << "H:" << qualsum[aln * match_width + i] << " ";
+            }
         }
     }
 
-    // do the row wise unitig features
-    for (auto g : grouped_unitig_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        out << "|unitig" << name << " ";
-        idx = 0;
-        for (auto& allele : alignment_alleles[aln]) {
-            out << ++idx << allele.alt << ":" << 1 << " "; //allele.prob << " ";
+    if (features & FEATURE_UNITIG) {
+        // do the row wise unitig features
+        for (auto g : grouped_unitig_alignments) {
+            auto& name = g.first;
+            auto& aln = g.second;
+            out << "|unitig" << name << " ";
+            idx = 0;
+            for (auto& allele : read_row(aln)) {
+                out << ++idx;
+                allele_seqs.write(out, allele.alt) << ":" << 1 << " "; //allele.prob << " ";
+            }
         }
     }
 
-    for (auto g : grouped_unitig_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        out << "|xmatch" << name << " ";
-        // match properties
-        for (auto w : matches[aln]) {
-            out << w.first+1 << "H:" << w.second << " ";
+    if (features & FEATURE_XMATCH) {
+        for (auto g : grouped_unitig_alignments) {
+            auto& name = g.first;
+            auto& aln = g.second;
+            out << "|xmatch" << name << " ";
+            // match properties
+            for (size_t i = 0; i < match_width; ++i) {
+                out << i+1 << "H:" << matches[aln * match_width + i] << " ";
+            }
         }
     }
 
-    out << "|depth ";
-    out << "bam:" << alignment_count << " ";
-    out << "graph:" << graph_alns.size() << " ";
+    if (features & FEATURE_DEPTH) {
+        out << "|depth ";
+        out << "bam:" << alignment_count << " ";
+        out << "graph:" << graph_alignment_count << " ";
+    }
 
-    out << "|likelihood ";
-    for (auto& l : likelihoods) {
-        out << l.first << "G:" << l.second << " ";
+    if (features & FEATURE_LIKELIHOOD) {
+        out << "|likelihood ";
+        for (size_t i = 0; i < genotype_count; ++i) {
+            out << genotype_labels[i] << "G:" << likelihoods[i] << " ";
+        }
     }
 
-    for (auto g : grouped_normal_alignments) {
-        auto& name = g.first;
-        auto& aln = g.second;
-        out << "|properties" << name << " ";
-        if (exponentiate) {
-            out << "mapqual:" << 1-phred2float(min(aln->MapQuality, (uint16_t)60)) << " ";
-        } else {
-            out << "mapqual:" << aln->MapQuality << " ";
-        }
-        // handle flags
-        if (aln->IsReverseStrand())     out << "strand:1"; else out << "strand:0"; out << " ";
-        if (aln->IsMateReverseStrand()) out << "ostrand:1"; else out << "ostrand:0"; out << " ";
-        if (aln->IsDuplicate())         out << "dup:1"; else out << "dup:0"; out << " ";
-        if (aln->IsFailedQC())          out << "qcfail:1"; else out << "qcfail:0"; out << " ";
-        if (aln->IsFirstMate())         out << "fmate:1"; else out << "fmate:0"; out << " ";
-        if (aln->IsSecondMate())        out << "xmate:1"; else out << "xmate:0"; out << " ";
-        if (aln->IsMateMapped())        out << "ymap:1"; else out << "ymap:0"; out << " ";
-        if (aln->IsPaired())            out << "paired:1"; else out << "paired:0"; out << " ";
-        if (aln->IsPrimaryAlignment())  out << "zprimary:1"; else out << "zprimary:0"; out << " ";
-        if (aln->IsProperPair())        out << "iproper:1"; else out << "iproper:0"; out << " ";
-    }
-
-    out << "|vgraph ";
-    graph.for_each_node([&](vg::Node* n) {
-            auto& seq = n->sequence();
-            for (int j = 0; j < seq.size(); ++j) {
-                out << n->id() << "_" << j << "_" << seq[j] << " ";
+    if (features & FEATURE_PROPERTIES) {
+        for (auto g : grouped_normal_alignments) {
+            auto& name = g.first;
+            auto aln = &alignments[g.second];
+            out << "|properties" << name << " ";
+            if (exponentiate) {
+                out << "mapqual:" << 1-phred2float(min(aln->MapQuality, (uint16_t)60)) << " ";
+            } else {
+                out << "mapqual:" << aln->MapQuality << " ";
             }
-        });
+            // handle flags
+            if (aln->IsReverseStrand())     out << "strand:1"; else out << "strand:0"; out << " ";
+            if (aln->IsMateReverseStrand()) out << "ostrand:1"; else out << "ostrand:0"; out << " ";
+            if (aln->IsDuplicate())         out << "dup:1"; else out << "dup:0"; out << " ";
+            if (aln->IsFailedQC())          out << "qcfail:1"; else out << "qcfail:0"; out << " ";
+            if (aln->IsFirstMate())         out << "fmate:1"; else out << "fmate:0"; out << " ";
+            if (aln->IsSecondMate())        out << "xmate:1"; else out << "xmate:0"; out << " ";
+            if (aln->IsMateMapped())        out << "ymap:1"; else out << "ymap:0"; out << " ";
+            if (aln->IsPaired())            out << "paired:1"; else out << "paired:0"; out << " ";
+            if (aln->IsPrimaryAlignment())  out << "zprimary:1"; else out << "zprimary:0"; out << " ";
+            if (aln->IsProperPair())        out << "iproper:1"; else out << "iproper:0"; out << " ";
+        }
+    }
+
+    if (features & FEATURE_VGRAPH) {
+        out << "|vgraph ";
+        graph.for_each_node([&](vg::Node* n) {
+                auto& seq = n->sequence();
+                for (int j = 0; j < seq.size(); ++j) {
+                    out << n->id() << "_" << j << "_" << seq[j] << " ";
+                }
+            });
+    }
 
-    out << "|kgraph ";
-    for (auto& w : graph_coverage) {
-        out << w.first << "C:" << w.second << " ";
+    if (features & FEATURE_KGRAPH) {
+        out << "|kgraph ";
+        for (auto& w : graph_coverage) {
+            out << w.first << "C:" << w.second << " ";
+        }
     }
 
-    out << "|software ";
-    // now handle caller input features
-    for (auto& f : call_info_num) {
-        out << f.first << ":" << f.second << " ";
+    if (features & FEATURE_SOFTWARE) {
+        out << "|software ";
+        // now handle caller input features
+        for (auto& f : call_info_num) {
+            out << f.first << ":" << f.second << " ";
+        }
     }
 
     // and the alignment supports
@@ -1667,10 +1955,108 @@ const string HHGA::vw(void) {
         out << f.first << "_" << f.second << " ";
     }
     */
-    return out.str();
 }
 
 
+void HHGA::tensor(string& buffer, const tensor_shape_t& shape) {
+    tensor_builder_t out(buffer, shape);
+    auto& header = out.header();
+    header.haplotypes = min((size_t)shape.haplotypes, haplotypes.size());
+    header.genotypes = min((size_t)shape.genotypes, genotypes.size());
+    header.reads = min((size_t)shape.reads, grouped_normal_alignments.size());
+    header.unitigs = min((size_t)shape.unitigs, grouped_unitig_alignments.size());
+    header.kgraph = min((size_t)shape.kgraph, graph_coverage.size());
+    header.depth = alignment_count;
+    header.graph_depth = graph_alignment_count;
+
+    // alleles without a symbol of their own are kept in the record's sequences
+    string sequences;
+    map<allele_code_t, uint16_t> escaped;
+    auto escape = [&](allele_code_t code) {
+        auto f = escaped.find(code);
+        if (f != escaped.end()) return f->second;
+        uint16_t index = escaped.size() + 1;
+        escaped[code] = index;
+        sequences.append(allele_seqs.decode(code));
+        sequences.push_back('\n');
+        return index;
+    };
+
+    // rows longer than the window are cut, and short ones stay zero
+    size_t row_index = 0;
+    auto put_row = [&](msa_row_t row) {
+        size_t n = min(row.size(), (size_t)shape.width);
+        float* weights = out.weights() + row_index * shape.width;
+        uint8_t* symbols = out.symbols() + row_index * shape.width;
+        uint16_t* escapes = out.escapes() + row_index * shape.width;
+        for (size_t i = 0; i < n; ++i) {
+            weights[i] = tensor_value(row[i].prob);
+            symbols[i] = packed_symbol(row[i].alt);
+            if (symbols[i] == PACKED_ESCAPE) escapes[i] = escape(row[i].alt);
+        }
+        ++row_index;
+    };
+    put_row(reference);
+    for (size_t i = 0; i < header.haplotypes; ++i) put_row(haplotypes[i]);
+    row_index = 1 + shape.haplotypes;
+    for (size_t i = 0; i < header.genotypes; ++i) put_row(genotypes[i]);
+    row_index = 1 + shape.haplotypes + shape.genotypes;
+    for (size_t i = 0; i < header.reads; ++i) {
+        put_row(read_row(grouped_normal_alignments[i].second));
+    }
+    row_index = 1 + shape.haplotypes + shape.genotypes + shape.reads;
+    for (size_t i = 0; i < header.unitigs; ++i) {
+        put_row(read_row(grouped_unitig_alignments[i].second));
+    }
+
+    // the group names start with the allele the read supports
+    size_t haps = min((size_t)shape.haplotypes, match_width);
+    for (size_t i = 0; i < header.reads; ++i) {
+        auto& g = grouped_normal_alignments[i];
+        out.groups()[i] = atoi(g.first.c_str());
+        for (size_t h = 0; h < haps; ++h) {
+            out.match()[i * shape.haplotypes + h] = tensor_value(matches[g.second * match_width + h]);
+            out.qual()[i * shape.haplotypes + h] = tensor_value(qualsum[g.second * match_width + h]);
+        }
+        auto aln = &alignments[g.second];
+        float* props = out.properties() + i * TENSOR_PROPERTIES;
+        props[0] = exponentiate
+            ? 1-phred2float(min(aln->MapQuality, (uint16_t)60))
+            : aln->MapQuality;
+        props[1] = aln->IsReverseStrand();
+        props[2] = aln->IsMateReverseStrand();
+        props[3] = aln->IsDuplicate();
+        props[4] = aln->IsFailedQC();
+        props[5] = aln->IsFirstMate();
+        props[6] = aln->IsSecondMate();
+        props[7] = aln->IsMateMapped();
+        props[8] = aln->IsPaired();
+        props[9] = aln->IsPrimaryAlignment();
+        props[10] = aln->IsProperPair();
+    }
+    for (size_t i = 0; i < header.unitigs; ++i) {
+        auto& g = grouped_unitig_alignments[i];
+        out.groups()[shape.reads + i] = atoi(g.first.c_str());
+        for (size_t h = 0; h < haps; ++h) {
+            out.match()[(shape.reads + i) * shape.haplotypes + h] = tensor_value(matches[g.second * match_width + h]);
+        }
+    }
+
+    // by label, as in the vw output
+    for (size_t i = 0; i < genotype_count; ++i) {
+        if (genotype_labels[i] <= shape.genotypes) {
+            out.likelihood()[genotype_labels[i]-1] = tensor_value(likelihoods[i]);
+        }
+    }
+    size_t k = 0;
+    for (auto& w : graph_coverage) {
+        if (k == header.kgraph) break;
+        out.kgraph()[k++] = tensor_value(w.second);
+    }
+
+    out.finish(repr, label, sequences);
+}
+
 vector<prob_t> deletion_probs(const vector<prob_t>& quals, size_t sp, size_t l) {
     
     // because deletions have no quality information,
@@ -1759,17 +2145,28 @@ vector<prob_t> insertion_probs(const vector<prob_t>& quals, size_t sp, size_t l)
     return ins_quals;
 }
 
+// without the site's allele_seqs_t, multi-base alleles are shown by their code
 ostream& operator<<(ostream& out, allele_t& var) {
-    out << var.position << ":" << var.ref << "/" << var.alt << ":" << var.prob;
+    auto symbol = [&](allele_code_t code) {
+        if (code >= ALLELE_SEQ_BASE) out << "#" << code - ALLELE_SEQ_BASE;
+        else if (code != ALLELE_EMPTY) out << (char) code;
+    };
+    out << var.position << ":";
+    symbol(var.ref);
+    out << "/";
+    symbol(var.alt);
+    out << ":" << var.prob;
     return out;
 }
 
-allele_t operator+(const allele_t& a, const allele_t& b) {
-    return allele_t(a.ref + b.ref, a.alt + b.alt, a.position, a.prob * b.prob);
+bool operator<(const allele_t& a, const allele_t& b) {
+    if (a.position != b.position) return a.position < b.position;
+    if (a.ref != b.ref) return a.ref < b.ref;
+    return a.alt < b.alt;
 }
 
-bool operator<(const allele_t& a, const allele_t& b) {
-    return a.repr < b.repr;
+uint64_t allele_key(const allele_t& a) {
+    return ((uint64_t)(uint32_t) a.position << 32) | ((uint64_t) a.ref << 16) | a.alt;
 }
 
 }
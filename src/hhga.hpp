@@ -2,6 +2,8 @@
 #define HHGA_H
 
 #include <map>
+#include <set>
+#include <memory>
 #include <vector>
 #include <string>
 #include <getopt.h>
@@ -18,6 +20,17 @@
 #include "constructor.hpp"
 #include "multichoose.h"
 #include "join.h"
+#include "sweep.hpp"
+#include "refcache.hpp"
+#include "reptrack.hpp"
+#include "arena.hpp"
+#include "packed.hpp"
+#include "genotype.hpp"
+#include "vw.hpp"
+#include "tensor.hpp"
+#include "bubble.hpp"
+#include "downsample.hpp"
+#include "stats.hpp"
 
 namespace hhga {
 
@@ -30,25 +43,136 @@ using namespace std;
 typedef double prob_t;
 typedef int32_t pos_t;
 
+typedef float weight_t;
+typedef uint16_t allele_code_t;
+
+// alleles are held as symbol codes rather than strings
+// a single base or MSA symbol (A C G T N U M R S) is coded as its character,
+// and longer sequences index the site's allele_seqs_t from ALLELE_SEQ_BASE
+// (a one-byte code would leave the struct the same size after padding)
+#define ALLELE_EMPTY 0
+#define ALLELE_SEQ_BASE 256
+// codes are 16 bits, so a site holds at most this many distinct multi-base alleles
+// past it, a code would wrap into the single characters and compare equal to a base,
+// so encode stops the run instead (--downsample bounds the reads of deep sites)
+#define ALLELE_SEQ_MAX (65536 - ALLELE_SEQ_BASE)
+
 class allele_t {
 public:
     friend ostream& operator<<(ostream& out, allele_t& var);
     friend bool operator<(const allele_t& a, const allele_t& b);
-    friend allele_t operator+(const allele_t& a, const allele_t& b);
-    prob_t prob;
-    string ref;
-    string alt;
-    string repr;
+    weight_t prob;
     int32_t position;
-    allele_t(string r, string a, long p, prob_t t)
-        : ref(r), alt(a), position(p), prob(t)
-    {
-        // a string representation is made and used for sorting
-        stringstream s;
-        s << position << ":" << ref << "/" << alt;
-        repr = s.str();
+    allele_code_t ref;
+    allele_code_t alt;
+    allele_t(void) = default;
+    allele_t(allele_code_t r, allele_code_t a, int32_t p, weight_t t)
+        : prob(t), position(p), ref(r), alt(a) { }
+};
+
+// the alleles of one row of the MSA, allocated from the site's arena
+typedef site_vector<allele_t> alleles_t;
+
+// the sequences of multi-base alleles at a site, which are stored out of line
+// codes are canonical, so alleles compare equal iff their codes do
+class allele_seqs_t {
+public:
+    allele_code_t encode(const string& seq) {
+        if (seq.empty()) return ALLELE_EMPTY;
+        if (seq.size() == 1) return (unsigned char) seq[0];
+        auto f = ids.find(seq);
+        if (f != ids.end()) return f->second;
+        if (seqs.size() == ALLELE_SEQ_MAX) {
+            cerr << "[hhga] more than " << ALLELE_SEQ_MAX << " distinct multi-base alleles at a site, "
+                 << "use --downsample to limit its reads" << endl;
+            exit(1);
+        }
+        allele_code_t code = ALLELE_SEQ_BASE + seqs.size();
+        seqs.push_back(seq);
+        ids[seq] = code;
+        return code;
+    }
+    const string decode(allele_code_t code) const {
+        if (code == ALLELE_EMPTY) return "";
+        if (code < ALLELE_SEQ_BASE) return string(1, (char) code);
+        return seqs[code - ALLELE_SEQ_BASE];
+    }
+    ostream& write(ostream& out, allele_code_t code) const {
+        if (code >= ALLELE_SEQ_BASE) out << seqs[code - ALLELE_SEQ_BASE];
+        else if (code != ALLELE_EMPTY) out << (char) code;
+        return out;
+    }
+    vw_writer_t& write(vw_writer_t& out, allele_code_t code) const {
+        if (code >= ALLELE_SEQ_BASE) out << seqs[code - ALLELE_SEQ_BASE];
+        else if (code != ALLELE_EMPTY) out << (char) code;
+        return out;
+    }
+private:
+    vector<string> seqs;
+    map<string, allele_code_t> ids;
+};
+
+// a row of the MSA, which points into its buffer
+class msa_row_t {
+public:
+    msa_row_t(void) : cells(nullptr), count(0) { }
+    msa_row_t(allele_t* c, size_t n) : cells(c), count(n) { }
+    allele_t* begin(void) const { return cells; }
+    allele_t* end(void) const { return cells + count; }
+    allele_t& operator[](size_t i) const { return cells[i]; }
+    size_t size(void) const { return count; }
+    bool empty(void) const { return count == 0; }
+private:
+    allele_t* cells;
+    size_t count;
+};
+
+// a column of the MSA, which steps through its buffer a row at a time
+// rows shorter than the column read as missing
+class msa_column_t {
+public:
+    msa_column_t(const allele_t* c, const uint32_t* s, size_t i, size_t w)
+        : cells(c), sizes(s), col(i), width(w) { }
+    const allele_t& operator[](size_t row) const {
+        return col < sizes[row] ? cells[row * width + col] : missing;
+    }
+private:
+    const allele_t* cells;
+    const uint32_t* sizes;
+    size_t col;
+    size_t width;
+    static const allele_t missing;
+};
+
+// the padded multiple sequence alignment of a site
+// every row has room for width alleles in one row-major buffer, allocated up front
+class msa_t {
+public:
+    void reset(size_t rows, size_t width);
+    size_t rows(void) const { return sizes.size(); }
+    size_t width(void) const { return col_count; }
+    msa_row_t row(size_t r) { return msa_row_t(&cells[r * col_count], sizes[r]); }
+    msa_column_t column(size_t c) const {
+        return msa_column_t(cells.data(), sizes.data(), c, col_count);
+    }
+    // add an allele to the end of row r, dropping it if the row is full
+    void push_back(size_t r, const allele_t& allele) {
+        if (sizes[r] < col_count) cells[r * col_count + sizes[r]++] = allele;
     }
-    const string str(void) const { stringstream s; s << position << ":" << ref << "/" << alt; return s.str(); }
+    // pack every row at 4 bits per symbol, once the alleles are final
+    void pack(void);
+    // pairwise_identity and pairwise_qualsum of row r1 against row r2, from the packed rows
+    // compare is packed_compare, or packed_compare_scalar to check the two agree
+    void match(size_t r1, size_t r2, double& identity, double& qualsum,
+               packed_compare_t compare = packed_compare);
+private:
+    size_t col_count = 0;
+    site_vector<allele_t> cells;
+    site_vector<uint32_t> sizes;
+    size_t packed_words = 0;
+    site_vector<uint64_t> packed;
+    site_vector<uint64_t> match_bits;
+    site_vector<uint64_t> escape_bits;
 };
 
 short qualityChar2ShortInt(char c);
@@ -70,6 +194,7 @@ void set_region(BamTools::BamMultiReader& reader,
                 int startPos,
                 int stopPos);
 void set_region(vcflib::VariantCallFile& vcffile, const string& region_str);
+uint64_t allele_key(const allele_t& a);
 vector<prob_t> deletion_probs(const vector<prob_t>& quals, size_t sp, size_t l);
 vector<prob_t> insertion_probs(const vector<prob_t>& quals, size_t sp, size_t l);
 
@@ -81,9 +206,9 @@ std::vector<std::string> split_delims(const std::string &s,
 
 map<int, double> test_labels(int alt_count);
 // fraction of times where both are non-missing where they agree
-double pairwise_identity(const vector<allele_t>& h1, const vector<allele_t>& h2);
-double pairwise_qualsum(const vector<allele_t>& h1, const vector<allele_t>& h2);
-int missing_count(const vector<allele_t>& hap);
+double pairwise_identity(const msa_row_t& h1, const msa_row_t& h2);
+double pairwise_qualsum(const msa_row_t& h1, const msa_row_t& h2);
+int missing_count(const msa_row_t& hap);
 double entropy(const string& st);
 bool is_repeat_unit(const string& seq, const string& unit);
 string repeat(const string& s, int n);
@@ -93,11 +218,88 @@ pair<int, int> callable_window(int pos,
                                string alleleseq,
                                int min_repeat_size,
                                double min_repeat_entropy);
+// the reference span reads must cover at a site, in absolute coordinates, from the
+// window of repeat_window_length around it that starts at repeat_window_start
+pair<int, int> site_callable_window(const string& repeat_window,
+                                    int repeat_window_start,
+                                    int repeat_window_length,
+                                    double min_repeat_entropy);
 vector<vector<int> > possible_genotypes(int allele_count, int ploidy);
 string string_for_genotype(const vector<int>& gt);
 int label_for_genotype(const string& gt, const vector<vector<int> >& genotypes);
+int label_for_genotype(const vector<int>& gt, const vector<vector<int> >& genotypes);
 string genotype_for_label(int label, const vector<vector<int> >& genotypes);
-pair<int, int> pair_for_gt_class(int gt);
+
+// the vw namespaces, which --features chooses from
+// the stages that only feed unwanted namespaces are skipped when building the site
+enum feature_t {
+    FEATURE_REF        = 1 << 0,
+    FEATURE_HAP        = 1 << 1,
+    FEATURE_GENO       = 1 << 2,
+    FEATURE_ALN        = 1 << 3,
+    FEATURE_COL        = 1 << 4,
+    FEATURE_MATCH      = 1 << 5,
+    FEATURE_QUAL       = 1 << 6,
+    FEATURE_UNITIG     = 1 << 7,
+    FEATURE_XMATCH     = 1 << 8,
+    FEATURE_DEPTH      = 1 << 9,
+    FEATURE_LIKELIHOOD = 1 << 10,
+    FEATURE_PROPERTIES = 1 << 11,
+    FEATURE_VGRAPH     = 1 << 12,
+    FEATURE_KGRAPH     = 1 << 13,
+    FEATURE_SOFTWARE   = 1 << 14
+};
+#define FEATURES_ALL 0x7fff
+
+// set features from a comma-separated list of namespaces, returning false on an unknown one
+bool parse_features(const string& list, uint32_t& features);
+
+// the readers used to build examples
+// each worker thread holds its own set, as none of them are safe to share
+class inputs_t {
+public:
+    BamTools::BamMultiReader bam_reader;
+    BamTools::BamMultiReader unitig_reader;
+    FastaReference fasta_ref;
+    // for sorted input, a single pass over each contig
+    SweepReader bam_sweep{bam_reader};
+    SweepReader unitig_sweep{unitig_reader};
+    // 2-bit packed, memory-mapped copy of fasta_ref
+    ReferenceCache ref_cache;
+    // backs the containers of each site, rewound after it is written
+    site_arena_t arena;
+    // what each site cost, for --stats
+    RunStats stats;
+    bool open(const vector<string>& bam_files,
+              const vector<string>& unitig_files,
+              const string& fasta_file,
+              bool use_ref_cache = false);
+};
+
+// how every site's example is built, set once from the command line
+struct hhga_options_t {
+    size_t window_length = 50;
+    size_t graph_window = 50;
+    string input_name;  // prefix of the VCF annotations
+    string class_label;
+    string gt_class;    // sample field the genotype class label comes from
+    int max_depth = 0;
+    int min_allele_count = 0;
+    double min_repeat_entropy = 0;
+    bool full_overlap = false;
+    int max_node_size = 0;
+    bool exponentiate = false;
+    bool show_bases = false;
+    bool assume_ref = false;
+    // read through the inputs_t's sweeps and reference cache
+    bool sweep = false;
+    bool use_ref_cache = false;
+    bool bubble_align = false;
+    uint32_t features = FEATURES_ALL;
+    int sample_depth = 0;
+    uint32_t sample_seed = 0;
+    const RepeatTrack* repeat_track = nullptr;
+};
 
 class HHGA {
 public:
@@ -110,78 +312,84 @@ public:
 
     // graph
     vg::VG graph;
-    vector<vg::Alignment> graph_alns;
-    map<int, double> graph_weights;
-    map<int, double> graph_coverage;
+    int graph_alignment_count;
+    site_map<int, double> graph_weights;
+    site_map<int, double> graph_coverage;
 
+    // containers are drawn from the current site_arena_t, when one is set
     //set<allele_t> alleles;
     int alignment_count;
-    vector<alignment_t> alignments;
-    set<alignment_t*> unitigs;
-    map<alignment_t*, vector<allele_t> > alignment_alleles;
-    map<alignment_t*, map<int, double> > matches;
-    map<alignment_t*, map<int, double> > qualsum;
+    // per-read state is held in parallel arrays, indexed by the read's offset in alignments
+    site_vector<alignment_t> alignments;
+    site_vector<bool> is_unitig;
+    site_vector<pos_t> read_positions;
+    site_vector<alleles_t> alignment_alleles; // before projection into the MSA
+    site_vector<int> missing_counts;
+    // match_width scores per read, one for each haplotype
+    size_t match_width;
+    site_vector<double> matches;
+    site_vector<double> qualsum;
     // handling genotype likelihoods
-    double prob_aln_gt(alignment_t* aln, int gt);
-    map<alignment_t*, map<int, double> > prob_aln_given_genotype;;
-    map<int, double> likelihoods;
-    map<int, map<double, vector<alignment_t*> > > allele_support;
-    map<int, vector<alignment_t*> > allele_examples; // same as support but limited number
-    vector<alignment_t*> softclipped;
-    map<alignment_t*, vector<string> > alignment_groups;
-    vector<pair<string, alignment_t*> > grouped_normal_alignments;
-    vector<pair<string, alignment_t*> > grouped_unitig_alignments;
-    map<string, map<int, int> > allele_counts;
-    map<alignment_t*, int> missing_counts;
+    // the site's genotypes are the first genotype_count in colex order, see genotype_at
+    size_t genotype_count;
+    site_vector<int> genotype_labels; // of each, as in all_genotypes
+    site_vector<double> prob_aln_given_genotype; // genotype_count per read
+    site_vector<double> likelihoods; // relative to the most likely genotype
+    site_map<int, site_map<double, site_vector<int> > > allele_support;
+    site_map<int, site_vector<int> > allele_examples; // same as support but limited number
+    site_vector<int> softclipped;
+    site_vector<pair<string, int> > grouped_normal_alignments;
+    site_vector<pair<string, int> > grouped_unitig_alignments;
+    // keyed by position, ref and alt codes, see allele_key
+    site_map<uint64_t, site_map<int, int> > allele_counts;
+    allele_seqs_t allele_seqs;
 
     // the class label for the example
     string label;
 
+    // the namespaces to build and write, from feature_t
+    uint32_t features;
+
     // do we express things in exponentiated or phred form
     bool exponentiate;
 
     // the feature model
-    vector<allele_t> reference;
-    vector<vector<allele_t> > haplotypes; // genotypes
-    vector<vector<allele_t> > genotypes; // genotypes
-    map<int, int> sample_id;
-    vector<vector<allele_t> > alleles;
-    vector<prob_t> mapping_qualities;
+    // the MSA holds the reference, then the haplotypes, the genotypes and the reads
+    msa_t msa;
+    msa_row_t reference;
+    site_vector<msa_row_t> haplotypes;
+    site_vector<msa_row_t> genotypes;
+    size_t read_row_offset;
+    // empty when the read misses the window
+    msa_row_t read_row(size_t r) { return msa.row(read_row_offset + r); }
+    site_map<int, int> sample_id;
+    site_vector<alleles_t> alleles;
+    site_vector<prob_t> mapping_qualities;
     map<string, double> call_info_num; // from input VCFs, numbers
     map<string, string> call_info_str; // from input VCFs, strings
 
     // helpers for construction 
-    vector<allele_t> pad_alleles(vector<allele_t> aln_alleles,
-                                 pos_t bal_min, pos_t bal_max);
-    void project_positions(vector<allele_t>& aln_alleles,
-                           map<pair<int32_t, size_t>, size_t>& pos_proj);
-    void flatten_to_ref(vector<allele_t>& alleles);
-    void strandify(vector<allele_t>& alleles, bool is_rev);
-    void missing_to_ref(vector<vector<allele_t> >& obs);
+    void pad_alleles(const alleles_t& aln_alleles,
+                     pos_t bal_min, pos_t bal_max, size_t row);
+    void project_positions(alleles_t& aln_alleles,
+                           site_map<pair<int32_t, size_t>, size_t>& pos_proj);
+    void flatten_to_ref(msa_row_t alleles);
+    void strandify(msa_row_t alleles, bool is_rev);
+    void missing_to_ref(site_vector<msa_row_t>& obs);
 
     // construct the hhga of a particular region
-    HHGA(size_t window_size,
-         BamTools::BamMultiReader& bam_reader,
-         BamTools::BamMultiReader& unitig_reader,
-         FastaReference& fasta_ref,
-         vcflib::VariantCallFile& graph_vcf,
-         size_t graph_window,
-         vcflib::Variant& var,
-         const string& input_name,
-         const string& class_label,
-         const string& gt_class,
+    HHGA(vcflib::Variant& var,
+         inputs_t& in,
+         const hhga_options_t& options,
          const vector<vector<int> >& all_genotypes,
-         int max_depth = 0,
-         int min_allele_count = 0,
-         double min_repeat_entropy = 0,
-         bool full_overlap = false,
-         int max_node_size = 0,
-         bool expon = false,
-         bool show_bases = false,
-         bool assume_ref = true);
+         site_stats_t* stats = nullptr);
 
     const string str(void);
     const string vw(void);
+    // append the example to buffer, which can be reused between sites
+    void vw(string& buffer);
+    // the same features as fixed-shape tensors, in a record for a TensorShardWriter
+    void tensor(string& buffer, const tensor_shape_t& shape);
 };
 
 }
@@ -0,0 +1,342 @@
+#include "ingest.hpp"
+#include "hhga.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+namespace hhga {
+
+// blocks read or written ahead of the one in use, which bounds the memory held
+#define INGEST_QUEUE_DEPTH 4
+#define INGEST_BLOCK_SIZE (1 << 20)
+
+LineReader::~LineReader(void) {
+    if (reader.joinable()) {
+        {
+            // a reader stopped early must not stay blocked on a full queue
+            lock_guard<mutex> lock(mtx);
+            done = true;
+            blocks.clear();
+        }
+        changed.notify_all();
+        reader.join();
+    }
+    if (in) bgzf_close(in);
+}
+
+bool LineReader::open(const string& path, size_t block_size) {
+    in = path == "-" ? bgzf_dopen(fileno(stdin), "r") : bgzf_open(path.c_str(), "r");
+    if (!in) {
+        cerr << "[hhga] could not open " << path << endl;
+        return false;
+    }
+    this->block_size = block_size;
+    reader = thread(&LineReader::read_blocks, this);
+    return true;
+}
+
+void LineReader::read_blocks(void) {
+    string partial; // a line cut by the end of the last read
+    while (true) {
+        string block;
+        block.swap(partial);
+        size_t start = block.size();
+        block.resize(start + block_size);
+        ssize_t n = bgzf_read(in, &block[start], block_size);
+        block.resize(start + max(n, (ssize_t)0));
+        if (n > 0) {
+            // the block ends at its last newline, and the rest begins the next one
+            const char* last = (const char*)memrchr(block.data() + start, '\n', n);
+            if (!last) {
+                partial.swap(block);
+                continue;
+            }
+            size_t cut = last - block.data() + 1;
+            partial.assign(block, cut, string::npos);
+            block.resize(cut);
+        } else if (!block.empty()) {
+            // a last line without its newline
+            block.push_back('\n');
+        }
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [&](void) { return blocks.size() < INGEST_QUEUE_DEPTH || done; });
+        if (done) return;
+        if (!block.empty()) blocks.push_back(std::move(block));
+        if (n <= 0) {
+            done = true;
+            error = n < 0;
+        }
+        changed.notify_all();
+        if (done) return;
+    }
+}
+
+bool LineReader::next(const char*& line, size_t& length) {
+    while (offset >= current.size()) {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [&](void) { return !blocks.empty() || done; });
+        if (blocks.empty()) return false;
+        current.swap(blocks.front());
+        blocks.pop_front();
+        offset = 0;
+        changed.notify_all();
+    }
+    // every block ends with a newline
+    line = current.data() + offset;
+    length = (const char*)memchr(line, '\n', current.size() - offset) - line;
+    offset += length + 1;
+    return true;
+}
+
+bool LineReader::failed(void) {
+    lock_guard<mutex> lock(mtx);
+    return error;
+}
+
+BlockWriter::BlockWriter(ostream& out) : out(out) {
+    writer = thread(&BlockWriter::write_blocks, this);
+}
+
+BlockWriter::~BlockWriter(void) {
+    close();
+}
+
+void BlockWriter::write(string& block) {
+    unique_lock<mutex> lock(mtx);
+    changed.wait(lock, [&](void) { return blocks.size() < INGEST_QUEUE_DEPTH; });
+    blocks.push_back(string());
+    blocks.back().swap(block);
+    changed.notify_all();
+}
+
+void BlockWriter::close(void) {
+    if (!writer.joinable()) return;
+    {
+        lock_guard<mutex> lock(mtx);
+        closing = true;
+    }
+    changed.notify_all();
+    writer.join();
+    out.flush();
+}
+
+void BlockWriter::write_blocks(void) {
+    string block;
+    while (true) {
+        {
+            unique_lock<mutex> lock(mtx);
+            changed.wait(lock, [&](void) { return !blocks.empty() || closing; });
+            if (blocks.empty()) return;
+            block.swap(blocks.front());
+            blocks.pop_front();
+            changed.notify_all();
+        }
+        out.write(block.data(), block.size());
+        block.clear();
+    }
+}
+
+// a field of a line, without copying it
+struct field_t {
+    const char* data;
+    size_t size;
+    bool operator==(const char* s) const { return size == strlen(s) && memcmp(data, s, size) == 0; }
+};
+
+static bool starts_with(const char* line, size_t length, const char* prefix) {
+    size_t n = strlen(prefix);
+    return length >= n && memcmp(line, prefix, n) == 0;
+}
+
+bool annotate_vcf(const string& vcf_file_name,
+                  const string& predictions_file_name,
+                  ostream& out,
+                  bool genotypes,
+                  const string& sample_name,
+                  const vector<vector<int> >& all_genotypes) {
+
+    LineReader vcf;
+    LineReader predictions;
+    if (!vcf.open(vcf_file_name) || !predictions.open(predictions_file_name)) {
+        return false;
+    }
+    BlockWriter writer(out);
+    string block;
+    block.reserve(2 * INGEST_BLOCK_SIZE);
+
+    // the prediction and the tag of the next example, which vw writes after it
+    field_t prediction = { nullptr, 0 };
+    field_t tag = { nullptr, 0 };
+    auto next_prediction = [&](void) {
+        const char* line;
+        size_t length;
+        while (predictions.next(line, length)) {
+            const char* end = line + length;
+            const char* p = line;
+            while (p < end && *p != ' ' && *p != '\t') ++p;
+            const char* t = p;
+            while (t < end && (*t == ' ' || *t == '\t')) ++t;
+            const char* e = t;
+            while (e < end && *e != ' ' && *e != '\t') ++e;
+            // strip off the leading ' if present
+            if (t < e && *t == '\'') ++t;
+            if (p == line || t == e) {
+                if (length) cerr << "hhga: error on line -- " << string(line, length) << endl;
+                continue;
+            }
+            prediction = { line, (size_t)(p - line) };
+            tag = { t, (size_t)(e - t) };
+            return true;
+        }
+        return false;
+    };
+    // the tag is CHROM_POS_REF_ALT, as HHGA::HHGA writes it
+    auto tag_matches = [&](const field_t* fields) {
+        const char* p = tag.data;
+        const char* end = tag.data + tag.size;
+        for (int i : { 0, 1, 3, 4 }) {
+            if (i && (p == end || *p++ != '_')) return false;
+            if ((size_t)(end - p) < fields[i].size
+                || memcmp(p, fields[i].data, fields[i].size) != 0) return false;
+            p += fields[i].size;
+        }
+        return p == end;
+    };
+    bool have_prediction = next_prediction();
+
+    bool has_info_header = false;
+    bool has_format_header = false;
+    const char* line;
+    size_t length;
+    field_t fields[10];
+    while (vcf.next(line, length)) {
+        if (starts_with(line, length, "##")) {
+            has_info_header = has_info_header || starts_with(line, length, "##INFO=<ID=prediction,");
+            has_format_header = has_format_header || starts_with(line, length, "##FORMAT=<ID=GT,");
+            block.append(line, length);
+            block.push_back('\n');
+            continue;
+        }
+        if (starts_with(line, length, "#")) {
+            // our header lines go last, before the column names
+            if (!has_info_header) {
+                block.append(genotypes
+                             ? "##INFO=<ID=prediction,Number=1,Type=Integer,Description=\"hhga+vw prediction for site\">\n"
+                             : "##INFO=<ID=prediction,Number=1,Type=Float,Description=\"hhga+vw prediction for site\">\n");
+            }
+            if (genotypes && !has_format_header) {
+                block.append("##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n");
+            }
+            block.append(line, length);
+            if (genotypes) {
+                if (!memmem(line, length, "\tFORMAT", 7)) block.append("\tFORMAT");
+                block.push_back('\t');
+                block.append(sample_name);
+            }
+            block.push_back('\n');
+            continue;
+        }
+
+        // the first nine columns, and the rest of the line in the tenth
+        const char* end = line + length;
+        const char* p = line;
+        int n = 0;
+        while (n < 9) {
+            const char* tab = (const char*)memchr(p, '\t', end - p);
+            fields[n++] = { p, (size_t)((tab ? tab : end) - p) };
+            if (!tab) break;
+            p = tab + 1;
+        }
+        if (n == 9 && p < end) fields[n++] = { p, (size_t)(end - p) };
+        if (n < 8) {
+            cerr << "[hhga] VCF record with fewer than 8 columns -- " << string(line, length) << endl;
+            block.append(line, length);
+            block.push_back('\n');
+            continue;
+        }
+
+        bool matched = have_prediction && tag_matches(fields);
+        auto& info = fields[7];
+        block.append(line, info.data - line);
+        if (!matched) {
+            block.append(info.data, info.size);
+        } else if (info == ".") {
+            block.append("prediction=");
+            block.append(prediction.data, prediction.size);
+        } else {
+            block.append(info.data, info.size);
+            block.append(";prediction=");
+            block.append(prediction.data, prediction.size);
+        }
+        if (!genotypes) {
+            block.append(info.data + info.size, end - (info.data + info.size));
+        } else {
+            string gt = ".";
+            if (matched) {
+                int label = atoi(string(prediction.data, prediction.size).c_str());
+                if (label > 0) {
+                    gt = genotype_for_label(label, all_genotypes);
+                } else {
+                    cerr << "warning: unknown label '" << label << "'" << endl;
+                    gt = "./.";
+                }
+            }
+            if (n == 8) {
+                block.append("\tGT\t");
+                block.append(gt);
+            } else {
+                // the new sample has the predicted GT and leaves the record's other fields missing
+                auto& format = fields[8];
+                int keys = 1 + count(format.data, format.data + format.size, ':');
+                int gt_key = -1;
+                const char* k = format.data;
+                for (int i = 0; i < keys; ++i) {
+                    const char* colon = (const char*)memchr(k, ':', format.data + format.size - k);
+                    const char* key_end = colon ? colon : format.data + format.size;
+                    if (key_end - k == 2 && k[0] == 'G' && k[1] == 'T') gt_key = i;
+                    k = key_end + 1;
+                }
+                block.push_back('\t');
+                if (gt_key < 0) {
+                    // GT comes first, and is missing for the samples already there
+                    block.append("GT:");
+                    block.append(format.data, format.size);
+                    const char* s = format.data + format.size;
+                    while (s < end) {
+                        const char* tab = (const char*)memchr(s + 1, '\t', end - s - 1);
+                        const char* sample_end = tab ? tab : end;
+                        block.append("\t.:");
+                        block.append(s + 1, sample_end - s - 1);
+                        s = sample_end;
+                    }
+                    gt_key = 0;
+                    ++keys;
+                } else {
+                    block.append(format.data, end - format.data);
+                }
+                for (int i = 0; i < keys; ++i) {
+                    block.push_back(i ? ':' : '\t');
+                    block.append(i == gt_key ? gt : ".");
+                }
+            }
+        }
+        block.push_back('\n');
+        if (matched) have_prediction = next_prediction();
+        if (block.size() >= INGEST_BLOCK_SIZE) writer.write(block);
+    }
+    writer.write(block);
+    writer.close();
+
+    if (vcf.failed() || predictions.failed()) {
+        cerr << "[hhga] error reading " << (vcf.failed() ? vcf_file_name : predictions_file_name) << endl;
+        return false;
+    }
+    if (have_prediction) {
+        cerr << "[hhga] no record of " << vcf_file_name << " matches the prediction for "
+             << string(tag.data, tag.size) << ", predictions must be in the order of the VCF" << endl;
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef HHGA_INGEST_H
+#define HHGA_INGEST_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "htslib/bgzf.h"
+
+namespace hhga {
+
+using namespace std;
+
+// the lines of a file, plain or BGZF, read ahead in blocks on a thread
+// so that parsing them never waits on the read
+class LineReader {
+public:
+    LineReader(void) { }
+    LineReader(const LineReader&) = delete;
+    ~LineReader(void);
+    // - reads stdin
+    bool open(const string& path, size_t block_size = 1 << 22);
+    // the next line, without its newline, which points into the current block
+    // and stays valid until the following call
+    bool next(const char*& line, size_t& length);
+    // true if reading stopped on an error rather than the end of the file
+    bool failed(void);
+private:
+    BGZF* in = nullptr;
+    size_t block_size = 0;
+    thread reader;
+    mutex mtx;
+    condition_variable changed;
+    deque<string> blocks; // each ends at the end of a line
+    bool done = false;
+    bool error = false;
+    string current;
+    size_t offset = 0;
+    void read_blocks(void);
+};
+
+// blocks written on a thread, so that formatting the next never waits on the write
+class BlockWriter {
+public:
+    BlockWriter(ostream& out);
+    BlockWriter(const BlockWriter&) = delete;
+    ~BlockWriter(void);
+    // the block is consumed, leaving it empty so the caller can reuse it
+    void write(string& block);
+    // writes what is queued and stops the thread
+    void close(void);
+private:
+    ostream& out;
+    thread writer;
+    mutex mtx;
+    condition_variable changed;
+    deque<string> blocks;
+    bool closing = false;
+    void write_blocks(void);
+};
+
+// writes the records of the candidate VCF that hhga made the examples from, each with the
+// prediction vw made for it as INFO prediction, and with genotypes, the genotype it labels
+// as the GT of a new sample, sample_name
+// predictions are matched to records by their tags, in order, so the examples must have
+// been written, and predicted, in the order of the VCF, but may skip records,
+// which are written as they were
+bool annotate_vcf(const string& vcf_file_name,
+                  const string& predictions_file_name,
+                  ostream& out,
+                  bool genotypes,
+                  const string& sample_name,
+                  const vector<vector<int> >& all_genotypes);
+
+}
+
+#endif
@@ -1,4 +1,9 @@
 #include "hhga.hpp"
+#include "reorder.hpp"
+#include "plan.hpp"
+#include "output.hpp"
+#include "ingest.hpp"
+#include <fstream>
 
 using namespace std;
 using namespace hhga;
@@ -6,6 +11,10 @@ using namespace hhga;
 void printUsage(int argc, char** argv) {
 
     cerr << "usage: " << argv[0] << " [-b FILE]" << endl
+         << "       " << argv[0] << " plan [options]     plan cost-balanced shards of a run" << endl
+         << "       " << argv[0] << " merge manifest.tsv concatenate shard outputs in manifest order" << endl
+         << "       " << argv[0] << " index-ref [options] precompute the callable windows of --min-entropy" << endl
+         << "       " << argv[0] << " view-tensors SHARD  print the shape and MSA rows of a --tensors shard" << endl
          << endl
          << "options:" << endl
          << "    -h, --help            this dialog" << endl
@@ -24,6 +33,9 @@ void printUsage(int argc, char** argv) {
          << "    -g, --gt-class FIELD  use this sample field to make genotype class labels" << endl
          << "    -e, --exponentiate    convert features that come PHRED-scaled to [0,1]" << endl
          << "    -x, --max-depth N     if depth is over N, downsample to N" << endl
+         << "    -D, --downsample N    keep at most N reads per strand as they are read, chosen by a" << endl
+         << "                          hash of their names, so the same reads are kept across sites" << endl
+         << "    -Z, --downsample-seed N  seed the read name hash of --downsample (default: 0)" << endl
          << "    -C, --min-count N     remove alleles observed less than N times (default: 0)" << endl
          << "    -E, --min-entropy N   the number of shannons/bp required of the haplotype window reads must cover" << endl
          << "    -o, --full-overlap    only print alignments that have no missing cells in the final matrix" << endl
@@ -31,7 +43,31 @@ void printUsage(int argc, char** argv) {
          << "    -a, --assume-ref      set missing sequences in the haps and genotypes to reference" << endl
          << "    -p, --binary-pred-in  stream in binary predictions and write annotated VCF" << endl
          << "    -G, --gt-pred-in      stream in class predictions and write annotated VCF" << endl
+         << "                          with -v, -p and -G annotate the records of the VCF the examples were made from," << endl
+         << "                          which predictions must follow in order, rather than rebuild them from the tags" << endl
          << "    -S, --sample NAME     name of the sample in the output VCF (use with --gt-class)" << endl
+         << "    -R, --ref-cache       read the reference through a shared, 2-bit packed FILE.hhref" << endl
+         << "                          (built next to the --fasta-reference on first use)" << endl
+         << "    -I, --repeat-track FILE  look up the windows reads must span for --min-entropy in this" << endl
+         << "                          track from hhga index-ref, built with the same -w and -E" << endl
+         << "    -q, --sweep           read each contig of the BAMs once, for a sorted --vcf" << endl
+         << "    -j, --threads N       build examples on N threads (output order matches the input VCF)" << endl
+         << "    -O, --output FILE     write to FILE rather than stdout (-), compressed on the --threads" << endl
+         << "                          with BGZF if it ends in .gz or .bgz, or zstd if in .zst" << endl
+         << "    -F, --features LIST   write only these comma-separated namespaces, and skip the work" << endl
+         << "                          for the others: ref,hap,geno,aln,col,match,qual,unitig,xmatch," << endl
+         << "                          depth,likelihood,properties,vgraph,kgraph,software (default: all)" << endl
+         << "    -H, --hashed          write vw feature names as the indices vw would hash them to," << endl
+         << "                          or without -b, hash the vw examples read on stdin" << endl
+         << "    -B, --hash-bits N     reduce hashed indices modulo 2^N, for vw -b N or less (default: 32)" << endl
+         << "    -K, --bubble-align    align reads in the graph window to the site's alleles with gssw," << endl
+         << "                          rather than through vg, which is faster (see README for how close)" << endl
+         << "    -X, --tensors PREFIX  write fixed-shape tensors to mmap-able shards PREFIX.N.hhts," << endl
+         << "                          rather than to --output" << endl
+         << "    -Y, --tensor-reads N  rows for reads, and for unitigs, in each tensor (default: 64)" << endl
+         << "    -M, --memory-stats    report per-thread arena use and peak RSS to stderr on exit" << endl
+         << "    -T, --stats FILE      write the time spent in each stage, read and MSA counts, and" << endl
+         << "                          per-site latency percentiles, by contig, as JSON (- for stderr)" << endl
          << "    -d, --debug           print useful debugging information to stderr" << endl
          << endl
          << "Generates examples for vw using a VCF file and BAM file." << endl
@@ -43,33 +79,49 @@ void printUsage(int argc, char** argv) {
 
 int main(int argc, char** argv) {
 
+    if (argc > 1) {
+        string command = argv[1];
+        if (command == "plan") {
+            return main_plan(argc-1, argv+1);
+        } else if (command == "merge") {
+            return main_merge(argc-1, argv+1);
+        } else if (command == "index-ref") {
+            return main_index_ref(argc-1, argv+1);
+        } else if (command == "view-tensors") {
+            return main_view_tensors(argc-1, argv+1);
+        }
+    }
+
+    // all output goes through cout in large blocks, so skip stdio's locking
+    std::ios_base::sync_with_stdio(false);
+
     // force single threaded (vg commands seem to go multi-threaded)
     omp_set_num_threads(1);
 
     vector<string> inputFilenames;
     vector<string> unitigFilenames;
     string vcf_file_name;
-    string vcf_feature_prefix;
     string region_string;
     string fastaFile;
     string graph_vcf_file_name;
     string output_format = "vw";
-    string class_label;
-    size_t window_size = 50;
-    size_t graph_window = 0;
+    // how each site is built, passed to every HHGA
+    hhga_options_t options;
+    options.graph_window = 0; // defaults to the window size
     bool debug = false;
-    bool exponentiate = false;
-    bool show_bases = false;
-    bool assume_ref = false; // assume haps are ref when not given
     bool binary_predictions_in = false;
     bool genotype_predictions_in = false;
-    string gt_class;
     string sample_name;
-    int max_depth = 0;
-    int max_node_size = 0;
-    int min_allele_count = 0;
-    int full_overlap = false;
-    double min_repeat_entropy = 0;
+    int threads = 1;
+    string repeat_track_file;
+    bool memory_stats = false;
+    string stats_file_name;
+    string output_file_name;
+    string tensor_prefix;
+    bool text_viz = false;
+    bool hashed = false;
+    int hash_bits = 32;
+    int tensor_reads = 64;
 
     // parse command-line options
     int c;
@@ -98,17 +150,32 @@ int main(int argc, char** argv) {
             {"gt-pred-in", no_argument, 0, 'G'},
             {"sample-name", required_argument, 0, 'S'},
             {"max-depth", required_argument, 0, 'x'},
+            {"downsample", required_argument, 0, 'D'},
+            {"downsample-seed", required_argument, 0, 'Z'},
             {"min-count", required_argument, 0, 'C'},
             {"full-overlap", no_argument, 0, 'o'},
             {"max-node-size", required_argument, 0, 'N'},
             {"min-entropy", required_argument, 0, 'E'},
+            {"threads", required_argument, 0, 'j'},
+            {"sweep", no_argument, 0, 'q'},
+            {"ref-cache", no_argument, 0, 'R'},
+            {"repeat-track", required_argument, 0, 'I'},
+            {"memory-stats", no_argument, 0, 'M'},
+            {"stats", required_argument, 0, 'T'},
+            {"output", required_argument, 0, 'O'},
+            {"features", required_argument, 0, 'F'},
+            {"hashed", no_argument, 0, 'H'},
+            {"bubble-align", no_argument, 0, 'K'},
+            {"hash-bits", required_argument, 0, 'B'},
+            {"tensors", required_argument, 0, 'X'},
+            {"tensor-reads", required_argument, 0, 'Y'},
             {"debug", no_argument, 0, 'd'},
             {0, 0, 0, 0}
         };
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "hb:u:r:f:v:tc:w:dn:espg:S:Gmax:V:N:W:C:oE:",
+        c = getopt_long (argc, argv, "hb:u:r:f:v:tc:w:dn:espg:S:Gmax:D:Z:V:N:W:C:oE:j:qRI:MT:O:X:Y:HB:KF:",
                          long_options, &option_index);
 
         if (c == -1)
@@ -143,7 +210,7 @@ int main(int argc, char** argv) {
             break;
 
         case 'n':
-            vcf_feature_prefix = optarg;
+            options.input_name = optarg;
             break;
 
         case 'r':
@@ -155,35 +222,35 @@ int main(int argc, char** argv) {
             break;
 
         case 't':
-            output_format = "text-viz";
+            text_viz = true;
             break;
 
         case 'c':
-            class_label = optarg;
+            options.class_label = optarg;
             break;
 
         case 'g':
-            gt_class = optarg;
+            options.gt_class = optarg;
             break;
 
         case 'w':
-            window_size = atoi(optarg);
+            options.window_length = atoi(optarg);
             break;
 
         case 'W':
-            graph_window = atoi(optarg);
+            options.graph_window = atoi(optarg);
             break;
 
         case 'e':
-            exponentiate = true;
+            options.exponentiate = true;
             break;
 
         case 's':
-            show_bases = true;
+            options.show_bases = true;
             break;
 
         case 'a':
-            assume_ref = true;
+            options.assume_ref = true;
             break;
 
         case 'p':
@@ -195,29 +262,92 @@ int main(int argc, char** argv) {
             break;
 
         case 'x':
-            max_depth = atoi(optarg);
+            options.max_depth = atoi(optarg);
+            break;
+
+        case 'D':
+            options.sample_depth = max(0, atoi(optarg));
+            break;
+
+        case 'Z':
+            options.sample_seed = strtoul(optarg, NULL, 10);
             break;
 
         case 'C':
-            min_allele_count = atoi(optarg);
+            options.min_allele_count = atoi(optarg);
             break;
 
         case 'o':
-            full_overlap = true;
+            options.full_overlap = true;
             break;
 
         case 'N':
-            max_node_size = atoi(optarg);
+            options.max_node_size = atoi(optarg);
             break;
 
         case 'E':
-            min_repeat_entropy = atof(optarg);
+            options.min_repeat_entropy = atof(optarg);
             break;
 
         case 'S':
             sample_name = optarg;
             break;
 
+        case 'j':
+            threads = max(1, atoi(optarg));
+            break;
+
+        case 'q':
+            options.sweep = true;
+            break;
+
+        case 'R':
+            options.use_ref_cache = true;
+            break;
+
+        case 'I':
+            repeat_track_file = optarg;
+            break;
+
+        case 'M':
+            memory_stats = true;
+            break;
+
+        case 'T':
+            stats_file_name = optarg;
+            break;
+
+        case 'O':
+            output_file_name = optarg;
+            break;
+
+        case 'F':
+            if (!parse_features(optarg, options.features)) {
+                return 1;
+            }
+            break;
+
+        case 'H':
+            hashed = true;
+            break;
+
+        case 'K':
+            options.bubble_align = true;
+            break;
+
+        case 'B':
+            hash_bits = min(32, max(1, atoi(optarg)));
+            break;
+
+        case 'X':
+            tensor_prefix = optarg;
+            output_format = "tensor";
+            break;
+
+        case 'Y':
+            tensor_reads = max(0, atoi(optarg));
+            break;
+
         case 'd':
             debug = true;
             break;
@@ -228,14 +358,52 @@ int main(int argc, char** argv) {
         }
     }
 
+    // each writes its own output, so only one can be asked for
+    if (text_viz && !tensor_prefix.empty()) {
+        cerr << "[hhga] --tensors cannot be combined with --text-viz" << endl;
+        return 1;
+    }
+    // tensors go to their own shards rather than --output, which would be left empty
+    if (!tensor_prefix.empty() && !output_file_name.empty() && output_file_name != "-") {
+        cerr << "[hhga] --output cannot be combined with --tensors, which writes PREFIX.N.hhts" << endl;
+        return 1;
+    }
+    // and only vw output has feature names to hash
+    if (hashed && (text_viz || !tensor_prefix.empty())) {
+        cerr << "[hhga] --hashed cannot be combined with " << (text_viz ? "--text-viz" : "--tensors") << endl;
+        return 1;
+    }
+    if (text_viz) {
+        output_format = "text-viz";
+    }
+
+    // examples and annotated VCFs go to --output if given, otherwise stdout
+    if (output_file_name == "-") {
+        output_file_name.clear();
+    }
+    OutputFile output_file;
+    if (!output_file_name.empty()
+        && !output_file.open(output_file_name, threads)) {
+        return 1;
+    }
+    ostream out(output_file_name.empty() ? cout.rdbuf() : &output_file);
+
     // get the allowed genotypes (static but should be made configurable)
     auto all_genotypes = possible_genotypes(16, 2);
     
     if (binary_predictions_in
         || genotype_predictions_in) {
 
-        stringstream headerss;
         if (sample_name.empty()) sample_name = "unknown";
+        // with the candidate VCF, annotate its records rather than rebuild them from the tags
+        if (!vcf_file_name.empty()) {
+            bool ok = annotate_vcf(vcf_file_name, "-", out, genotype_predictions_in,
+                                   sample_name, all_genotypes);
+            out.flush();
+            return output_file.close() && ok ? 0 : 1;
+        }
+
+        stringstream headerss;
         headerss 
             << "##fileformat=VCFv4.1" << endl
             << "##source=hhga" << endl
@@ -253,7 +421,7 @@ int main(int argc, char** argv) {
         string header = headerss.str();
         vcf_file.openForOutput(header);
         // add sample
-        cout << vcf_file.header << endl;
+        out << vcf_file.header << endl;
         
         // stream in predictions, use the annotation we apply to the vw input
         // to reconstruct a VCF file with our model's predictions as an INFO field
@@ -301,14 +469,32 @@ int main(int argc, char** argv) {
                         genotype_for_label(atoi(prediction.c_str()), all_genotypes));
                     var.format.push_back("GT");
                 }
-                cout << var << endl;
+                out << var << endl;
             } catch (...) {
                 cerr << "hhga: error on line -- " << line << endl;
             }
         }
-        return 0;
+        out.flush();
+        return output_file.close() ? 0 : 1;
     }
     
+    // without input files, -H hashes the vw examples on stdin, such as those written without it
+    if (hashed && inputFilenames.empty()) {
+        vw_hasher_t hasher(hash_bits);
+        string record;
+        for (string line; getline(cin, line); ) {
+            hasher.hash(line.data(), line.data() + line.size(), record);
+            record.push_back('\n');
+            if (record.size() >= 1 << 20) {
+                out << record;
+                record.clear();
+            }
+        }
+        out << record;
+        out.flush();
+        return output_file.close() ? 0 : 1;
+    }
+
     if (fastaFile.empty()) {
         cerr << "no FASTA reference specified" << endl;
         printUsage(argc, argv);
@@ -321,18 +507,6 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    BamTools::BamMultiReader bam_reader;
-    if (!bam_reader.Open(inputFilenames)) {
-        cerr << "could not open input BAM files" << endl;
-        return 1;
-    }
-
-    BamTools::BamMultiReader unitig_reader;
-    if (!unitig_reader.Open(unitigFilenames)) {
-        cerr << "could not open input unitig BAM files" << endl;
-        return 1;
-    }
-
     vcflib::VariantCallFile vcf_file;
     if (!vcf_file_name.empty()) {
         vcf_file.open(vcf_file_name);
@@ -345,21 +519,53 @@ int main(int argc, char** argv) {
     if (graph_vcf_file_name.empty()) {
         graph_vcf_file_name = vcf_file_name;
     }
-    vcflib::VariantCallFile graph_ref;
+    // checked once here, as each site's graph is built from its own record
     if (!graph_vcf_file_name.empty()) {
-        graph_ref.open(graph_vcf_file_name);
-        if (!graph_ref.is_open()) {
+        vcflib::VariantCallFile graph_vcf;
+        graph_vcf.open(graph_vcf_file_name);
+        if (!graph_vcf.is_open()) {
             cerr << "could not open " << graph_vcf_file_name << endl;
             return 1;
         }
     }
 
-    if (graph_window == 0) {
-        graph_window = window_size;
+    if (options.graph_window == 0) {
+        options.graph_window = options.window_length;
+    }
+
+    // every tensor has the shape of the largest site we could see
+    // haplotypes and genotypes follow the allowed genotypes, and the graph
+    // gets a node per base of the window and as many again for variants
+    int max_allele = 0;
+    for (auto& gt : all_genotypes) {
+        for (auto a : gt) max_allele = max(max_allele, a);
+    }
+    tensor_shape_t tensor_shape = { (uint32_t)options.window_length,
+                                    (uint32_t)max_allele + 1,
+                                    (uint32_t)all_genotypes.size(),
+                                    (uint32_t)tensor_reads,
+                                    (uint32_t)tensor_reads,
+                                    (uint32_t)(2 * options.graph_window) };
+    TensorShardWriter shard_writer(tensor_prefix, tensor_shape);
+    ostream tensor_out(&shard_writer);
+
+    // read-only and mapped, so the workers share it
+    RepeatTrack repeat_track;
+    if (!repeat_track_file.empty()
+        && !repeat_track.open(repeat_track_file, options.window_length, options.min_repeat_entropy)) {
+        return 1;
+    }
+    if (repeat_track.is_open()) {
+        options.repeat_track = &repeat_track;
     }
 
-    FastaReference fasta_ref;
-    fasta_ref.open(fastaFile);
+    // each worker gets its own readers, as seeking is stateful
+    vector<inputs_t> inputs(threads);
+    for (auto& in : inputs) {
+        if (!in.open(inputFilenames, unitigFilenames, fastaFile, options.use_ref_cache)) {
+            return 1;
+        }
+    }
 
     // if we've got a limiting region, use it
     if (!region_string.empty()) {
@@ -367,32 +573,104 @@ int main(int argc, char** argv) {
     }
 
     // iterate through all the vcf records, building one hhga matrix for each
-    vcflib::Variant var(vcf_file);
-    while (vcf_file.getNextVariant(var)) {
-        if (debug) { cerr << "Got variant " << var << endl; }
-        HHGA hhga(window_size,
-                  bam_reader,
-                  unitig_reader,
-                  fasta_ref,
-                  graph_ref,
-                  graph_window,
-                  var,
-                  vcf_feature_prefix,
-                  class_label,
-                  gt_class,
-                  all_genotypes,
-                  max_depth,
-                  min_allele_count,
-                  min_repeat_entropy,
-                  full_overlap,
-                  max_node_size,
-                  exponentiate,
-                  show_bases,
-                  assume_ref);
-        if (output_format == "vw") {
-            cout << hhga.vw() << endl;
-        } else if (output_format == "text-viz") {
-            cout << hhga.str() << endl;
+    // workers pull the next record as soon as they are free, so a deep site
+    // only holds up its own thread, and the reorder buffer restores input order
+    ReorderBuffer output(output_format == "tensor" ? tensor_out : out);
+    bool collect_stats = !stats_file_name.empty();
+    double run_start = wall_seconds();
+    size_t next_site = 0;
+    bool vcf_done = false;
+#pragma omp parallel num_threads(threads)
+    {
+        inputs_t& in = inputs[omp_get_thread_num()];
+        vcflib::Variant var(vcf_file);
+        // reused from site to site, so its capacity settles at the largest example
+        string record;
+        // the unhashed example, and the hashes of the names seen so far
+        string example;
+        vw_hasher_t hasher(hash_bits);
+        site_stats_t site;
+        while (true) {
+            size_t site_id;
+            bool got_site = false;
+            site = site_stats_t();
+            double site_start = collect_stats ? wall_seconds() : 0;
+#pragma omp critical (vcf_input)
+            {
+                if (!vcf_done && vcf_file.getNextVariant(var)) {
+                    site_id = next_site++;
+                    got_site = true;
+                    if (debug) { cerr << "Got variant " << var << endl; }
+                } else {
+                    vcf_done = true;
+                }
+            }
+            if (!got_site) break;
+            {
+                // the site's containers live in the worker's arena until it is rewound
+                arena_scope_t scope(in.arena);
+                HHGA hhga(var, in, options, all_genotypes,
+                          collect_stats ? &site : nullptr);
+                stage_clock_t clock(collect_stats ? &site : nullptr, STAGE_FORMAT);
+                if (output_format == "vw" && hashed) {
+                    example.clear();
+                    hhga.vw(example);
+                    hasher.hash(example.data(), example.data() + example.size(), record);
+                    record.push_back('\n');
+                } else if (output_format == "vw") {
+                    hhga.vw(record);
+                    record.push_back('\n');
+                } else if (output_format == "text-viz") {
+                    record = hhga.str() + "\n";
+                } else if (output_format == "tensor") {
+                    hhga.tensor(record, tensor_shape);
+                }
+            }
+            in.arena.rewind();
+            if (collect_stats) {
+                site.bytes = record.size();
+                site.wall = wall_seconds() - site_start;
+                in.stats.add(var.sequenceName, site);
+            }
+            output.write(site_id, record);
+        }
+    }
+    output.flush();
+    out.flush();
+    if (!output_file.close()
+        || (output_format == "tensor" && !shard_writer.close())) {
+        return 1;
+    }
+
+    if (memory_stats) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            auto& arena = inputs[i].arena;
+            cerr << "[hhga] thread " << i
+                 << " sites " << arena.sites
+                 << " allocations/site " << (arena.sites ? arena.allocations / arena.sites : 0)
+                 << " mallocs " << arena.mallocs
+                 << " peak_site_bytes " << arena.peak
+                 << " arena_bytes " << arena.capacity << endl;
+        }
+        cerr << "[hhga] heap allocations outside arenas " << site_heap_allocations << endl
+             << "[hhga] peak RSS " << peak_rss_kb() << " kB" << endl;
+    }
+
+    if (collect_stats) {
+        RunStats stats;
+        for (auto& in : inputs) {
+            stats.merge(in.stats);
+        }
+        double wall = wall_seconds() - run_start;
+        if (stats_file_name == "-") {
+            stats.write_json(cerr, wall, process_cpu_seconds(), threads);
+        } else {
+            ofstream stats_file(stats_file_name);
+            if (!stats_file) {
+                cerr << "[hhga] could not open " << stats_file_name << " for writing" << endl;
+                return 1;
+            }
+            stats.write_json(stats_file, wall, process_cpu_seconds(), threads);
         }
     }
 
@@ -0,0 +1,130 @@
+#include "output.hpp"
+#include <iostream>
+
+namespace hhga {
+
+static bool ends_with(const string& s, const string& suffix) {
+    return s.size() >= suffix.size()
+        && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+output_codec_t codec_for_path(const string& path) {
+    if (ends_with(path, ".gz") || ends_with(path, ".bgz")) {
+        return OUTPUT_BGZF;
+    } else if (ends_with(path, ".zst")) {
+        return OUTPUT_ZSTD;
+    } else {
+        return OUTPUT_PLAIN;
+    }
+}
+
+OutputFile::~OutputFile(void) {
+    close();
+}
+
+bool OutputFile::open(const string& p, int threads) {
+    path = p;
+    codec = codec_for_path(path);
+    switch (codec) {
+    case OUTPUT_BGZF:
+        bgzf = bgzf_open(path.c_str(), "w");
+        if (bgzf && threads > 1) {
+            // blocks are deflated by the pool in batches of 256
+            bgzf_mt(bgzf, threads, 256);
+        }
+        break;
+    case OUTPUT_ZSTD:
+#ifdef HAVE_ZSTD
+        file = fopen(path.c_str(), "wb");
+        if (file) {
+            zstd = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, 3);
+            if (threads > 1) {
+                ZSTD_CCtx_setParameter(zstd, ZSTD_c_nbWorkers, threads);
+            }
+            zstd_out.resize(ZSTD_CStreamOutSize());
+        }
+#else
+        cerr << "[hhga] this build has no zstd support, use a .gz output instead" << endl;
+        return false;
+#endif
+        break;
+    default:
+        file = fopen(path.c_str(), "wb");
+        break;
+    }
+    if (!is_open()) {
+        cerr << "[hhga] could not open " << path << " for writing" << endl;
+        return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_ZSTD
+bool OutputFile::zstd_write(const char* s, size_t n, ZSTD_EndDirective mode) {
+    ZSTD_inBuffer in = { s, n, 0 };
+    size_t remaining;
+    do {
+        ZSTD_outBuffer out = { &zstd_out[0], zstd_out.size(), 0 };
+        remaining = ZSTD_compressStream2(zstd, &out, &in, mode);
+        if (ZSTD_isError(remaining)) {
+            cerr << "[hhga] zstd error writing " << path << ": "
+                 << ZSTD_getErrorName(remaining) << endl;
+            return false;
+        }
+        if (fwrite(out.dst, 1, out.pos, file) != out.pos) return false;
+        // with continue, we are done once the input is consumed
+        // with end, once the frame is complete
+    } while (mode == ZSTD_e_end ? remaining != 0 : in.pos < in.size);
+    return true;
+}
+#endif
+
+streamsize OutputFile::xsputn(const char* s, streamsize n) {
+    if (failed || !is_open()) return 0;
+    switch (codec) {
+    case OUTPUT_BGZF:
+        failed = bgzf_write(bgzf, s, n) != n;
+        break;
+#ifdef HAVE_ZSTD
+    case OUTPUT_ZSTD:
+        failed = !zstd_write(s, n, ZSTD_e_continue);
+        break;
+#endif
+    default:
+        failed = fwrite(s, 1, n, file) != (size_t)n;
+        break;
+    }
+    return failed ? 0 : n;
+}
+
+int OutputFile::overflow(int c) {
+    if (c == traits_type::eof()) return traits_type::not_eof(c);
+    char ch = c;
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+bool OutputFile::close(void) {
+    if (!is_open()) return !failed;
+    if (codec == OUTPUT_BGZF) {
+        // waits for the pool to drain and writes the EOF block
+        if (bgzf_close(bgzf) != 0) failed = true;
+        bgzf = nullptr;
+    } else {
+#ifdef HAVE_ZSTD
+        if (zstd) {
+            if (!failed && !zstd_write(nullptr, 0, ZSTD_e_end)) failed = true;
+            ZSTD_freeCCtx(zstd);
+            zstd = nullptr;
+        }
+#endif
+        if (fclose(file) != 0) failed = true;
+        file = nullptr;
+    }
+    if (failed) {
+        cerr << "[hhga] error writing " << path << endl;
+    }
+    return !failed;
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef HHGA_OUTPUT_H
+#define HHGA_OUTPUT_H
+
+#include <string>
+#include <streambuf>
+#include <cstdio>
+#include "htslib/bgzf.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace hhga {
+
+using namespace std;
+
+enum output_codec_t { OUTPUT_PLAIN, OUTPUT_BGZF, OUTPUT_ZSTD };
+
+// .gz and .bgz are written as BGZF, which gzip and zcat read, .zst as zstd
+output_codec_t codec_for_path(const string& path);
+
+// a file that compresses what is written to it on a pool of threads
+// it is a streambuf, so an ostream over it can stand in for cout
+class OutputFile : public streambuf {
+public:
+    OutputFile(void) { }
+    OutputFile(const OutputFile&) = delete;
+    ~OutputFile(void);
+    bool open(const string& path, int threads);
+    bool is_open(void) const { return codec == OUTPUT_BGZF ? bgzf != nullptr : file != nullptr; }
+    // finishes the stream, returning false if anything failed to write
+    bool close(void);
+protected:
+    streamsize xsputn(const char* s, streamsize n);
+    int overflow(int c);
+private:
+    string path;
+    output_codec_t codec = OUTPUT_PLAIN;
+    bool failed = false;
+    FILE* file = nullptr; // plain and zstd output
+    BGZF* bgzf = nullptr;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstd = nullptr;
+    string zstd_out;
+    bool zstd_write(const char* s, size_t n, ZSTD_EndDirective mode);
+#endif
+};
+
+}
+
+#endif
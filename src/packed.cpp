@@ -0,0 +1,95 @@
+#include "packed.hpp"
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+namespace hhga {
+
+// nibbles 1-14, in order; missing (M) is 0
+static const char packed_alphabet[] = "ACGTNRUSacgtnu";
+
+struct packed_table_t {
+    uint8_t symbols[256];
+    packed_table_t(void) {
+        for (int i = 0; i < 256; ++i) symbols[i] = PACKED_ESCAPE;
+        symbols[(unsigned char)'M'] = PACKED_MISSING;
+        for (int i = 0; packed_alphabet[i]; ++i) {
+            symbols[(unsigned char)packed_alphabet[i]] = i + 1;
+        }
+    }
+};
+
+static const packed_table_t packed_table;
+
+uint8_t packed_symbol(uint16_t code) {
+    return code < 256 ? packed_table.symbols[code] : PACKED_ESCAPE;
+}
+
+char packed_char(uint8_t symbol) {
+    if (symbol == PACKED_MISSING) return 'M';
+    if (symbol == PACKED_ESCAPE || symbol > sizeof(packed_alphabet) - 1) return 0;
+    return packed_alphabet[symbol - 1];
+}
+
+size_t packed_row_words(size_t width) {
+    size_t words = (width + PACKED_SYMBOLS_PER_WORD - 1) / PACKED_SYMBOLS_PER_WORD;
+    return (words + 1) & ~(size_t)1;
+}
+
+// each of these leaves the answer in the low bit of every nibble
+static const uint64_t nibble_low_bits = 0x1111111111111111ULL;
+
+static inline uint64_t nonzero_nibbles(uint64_t w) {
+    w |= w >> 1;
+    w |= w >> 2;
+    return w & nibble_low_bits;
+}
+
+static inline uint64_t full_nibbles(uint64_t w) {
+    w &= w >> 1;
+    w &= w >> 2;
+    return w & nibble_low_bits;
+}
+
+size_t packed_compare_scalar(const uint64_t* x, const uint64_t* y, size_t words,
+                             uint64_t* match, uint64_t* escaped) {
+    size_t present = 0;
+    for (size_t i = 0; i < words; ++i) {
+        present += __builtin_popcountll(nonzero_nibbles(y[i]));
+        uint64_t m = ~nonzero_nibbles(x[i] ^ y[i]) & nonzero_nibbles(x[i]);
+        match[i] = m;
+        escaped[i] = full_nibbles(x[i]) & m;
+    }
+    return present;
+}
+
+size_t packed_compare(const uint64_t* x, const uint64_t* y, size_t words,
+                      uint64_t* match, uint64_t* escaped) {
+    size_t present = 0;
+    size_t i = 0;
+#ifdef __SSE4_1__
+    const __m128i low = _mm_set1_epi64x(nibble_low_bits);
+    auto nonzero = [&](__m128i w) {
+        w = _mm_or_si128(w, _mm_srli_epi64(w, 1));
+        w = _mm_or_si128(w, _mm_srli_epi64(w, 2));
+        return _mm_and_si128(w, low);
+    };
+    for ( ; i + 2 <= words; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i in_b = nonzero(b);
+        present += __builtin_popcountll(_mm_extract_epi64(in_b, 0))
+            + __builtin_popcountll(_mm_extract_epi64(in_b, 1));
+        // where the nibbles are equal and a is present, so is b
+        __m128i m = _mm_andnot_si128(nonzero(_mm_xor_si128(a, b)), nonzero(a));
+        __m128i e = _mm_and_si128(a, _mm_srli_epi64(a, 1));
+        e = _mm_and_si128(e, _mm_srli_epi64(e, 2));
+        e = _mm_and_si128(e, m);
+        _mm_storeu_si128((__m128i*)(match + i), m);
+        _mm_storeu_si128((__m128i*)(escaped + i), e);
+    }
+#endif
+    return present + packed_compare_scalar(x + i, y + i, words - i, match + i, escaped + i);
+}
+
+}
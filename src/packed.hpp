@@ -0,0 +1,39 @@
+#ifndef HHGA_PACKED_H
+#define HHGA_PACKED_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace hhga {
+
+// MSA rows packed at 4 bits per symbol, 16 to a word, first symbol in the low bits
+// the common symbols get their own nibble, and everything else (multi-base
+// alleles, unusual characters) shares the escape nibble, so equal nibbles only
+// prove equal alleles when they are not escapes
+#define PACKED_MISSING 0
+#define PACKED_ESCAPE 15
+#define PACKED_SYMBOLS_PER_WORD 16
+
+// the nibble for an allele code
+uint8_t packed_symbol(uint16_t code);
+// the character of a nibble, 'M' for missing and 0 for the escape
+char packed_char(uint8_t symbol);
+
+// words per packed row, rounded up so rows can be read 128 bits at a time
+size_t packed_row_words(size_t width);
+
+// compare rows x and y, words long
+// match gets the low bit of each nibble set where both hold the same symbol and it is not missing,
+// escaped gets the subset of those that are escapes, which the caller has to resolve
+// returns the number of symbols in y that are not missing
+size_t packed_compare(const uint64_t* x, const uint64_t* y, size_t words,
+                      uint64_t* match, uint64_t* escaped);
+// the same, a word at a time, as packed_compare does for the words SSE4.1 leaves
+size_t packed_compare_scalar(const uint64_t* x, const uint64_t* y, size_t words,
+                             uint64_t* match, uint64_t* escaped);
+typedef size_t (*packed_compare_t)(const uint64_t* x, const uint64_t* y, size_t words,
+                                   uint64_t* match, uint64_t* escaped);
+
+}
+
+#endif
@@ -0,0 +1,361 @@
+#include "plan.hpp"
+
+namespace hhga {
+
+const string shard_t::region(void) const {
+    stringstream s;
+    s << seq_name << ":" << begin + 1 << "-" << end;
+    return s.str();
+}
+
+string bai_for_bam(const string& bam_file) {
+    // samtools writes x.bam.bai, picard writes x.bai
+    string bai = bam_file + ".bai";
+    if (ifstream(bai).good()) return bai;
+    if (bam_file.size() > 4
+        && bam_file.substr(bam_file.size() - 4) == ".bam") {
+        bai = bam_file.substr(0, bam_file.size() - 4) + ".bai";
+        if (ifstream(bai).good()) return bai;
+    }
+    return "";
+}
+
+bool bai_window_bytes(const string& bai_file, vector<vector<uint64_t> >& bytes) {
+    ifstream in(bai_file, ios::in | ios::binary);
+    if (!in.good()) return false;
+    char magic[4];
+    in.read(magic, 4);
+    if (!in.good() || strncmp(magic, "BAI\1", 4) != 0) {
+        cerr << "[hhga plan] " << bai_file << " is not a BAM index" << endl;
+        return false;
+    }
+    int32_t n_ref = 0;
+    in.read((char*)&n_ref, sizeof(n_ref));
+    if (bytes.size() < n_ref) bytes.resize(n_ref);
+    for (int32_t r = 0; r < n_ref; ++r) {
+        // the end of the reference's data, in compressed file offsets
+        uint64_t ref_end = 0;
+        int32_t n_bin = 0;
+        in.read((char*)&n_bin, sizeof(n_bin));
+        for (int32_t b = 0; b < n_bin; ++b) {
+            uint32_t bin = 0;
+            int32_t n_chunk = 0;
+            in.read((char*)&bin, sizeof(bin));
+            in.read((char*)&n_chunk, sizeof(n_chunk));
+            for (int32_t c = 0; c < n_chunk; ++c) {
+                uint64_t chunk_beg = 0, chunk_end = 0;
+                in.read((char*)&chunk_beg, sizeof(chunk_beg));
+                in.read((char*)&chunk_end, sizeof(chunk_end));
+                // the pseudo-bin's second chunk holds read counts, not offsets
+                if (bin == BAI_PSEUDO_BIN && c > 0) continue;
+                ref_end = max(ref_end, chunk_end >> 16);
+            }
+        }
+        int32_t n_intv = 0;
+        in.read((char*)&n_intv, sizeof(n_intv));
+        vector<uint64_t> offsets(n_intv);
+        for (int32_t i = 0; i < n_intv; ++i) {
+            uint64_t ioffset = 0;
+            in.read((char*)&ioffset, sizeof(ioffset));
+            offsets[i] = ioffset >> 16;
+        }
+        if (!in.good()) {
+            cerr << "[hhga plan] truncated BAM index " << bai_file << endl;
+            return false;
+        }
+        // windows without alignments may be left at 0 by some writers
+        uint64_t first = 0;
+        for (auto o : offsets) if (o) { first = o; break; }
+        uint64_t last = first;
+        for (auto& o : offsets) {
+            if (o < last) o = last;
+            last = o;
+        }
+        auto& ref_bytes = bytes[r];
+        if (ref_bytes.size() < offsets.size()) ref_bytes.resize(offsets.size(), 0);
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            uint64_t next = (i + 1 < offsets.size() ? offsets[i+1] : max(ref_end, offsets[i]));
+            ref_bytes[i] += next - offsets[i];
+        }
+    }
+    return true;
+}
+
+vector<shard_t> plan_shards(const BamTools::RefVector& references,
+                            const vector<vector<uint64_t> >& window_bytes,
+                            const map<string, vector<uint64_t> >& window_sites,
+                            const map<string, set<size_t> >& no_cut,
+                            int shard_count,
+                            double site_cost) {
+
+    // the cost of a window is the number of candidates in it
+    // scaled by the depth, which we take from the compressed size of its reads
+    auto window_cost = [&](int ref_id, size_t w, uint64_t& sites) {
+        sites = 0;
+        auto f = window_sites.find(references[ref_id].RefName);
+        if (f != window_sites.end() && w < f->second.size()) sites = f->second[w];
+        uint64_t bytes = 0;
+        if (ref_id < window_bytes.size() && w < window_bytes[ref_id].size()) {
+            bytes = window_bytes[ref_id][w];
+        }
+        return (double) sites * (site_cost + bytes);
+    };
+
+    double total = 0;
+    for (int r = 0; r < references.size(); ++r) {
+        size_t n_windows = (references[r].RefLength >> BAI_LINEAR_SHIFT) + 1;
+        uint64_t sites;
+        for (size_t w = 0; w < n_windows; ++w) total += window_cost(r, w, sites);
+    }
+    double target = total / max(1, shard_count);
+
+    vector<shard_t> shards;
+    for (int r = 0; r < references.size(); ++r) {
+        auto& ref = references[r];
+        size_t n_windows = (ref.RefLength >> BAI_LINEAR_SHIFT) + 1;
+        shard_t shard;
+        shard.seq_name = ref.RefName;
+        shard.begin = 0;
+        shard.sites = 0;
+        shard.cost = 0;
+        auto f = no_cut.find(ref.RefName);
+        const set<size_t>* blocked = (f != no_cut.end() ? &f->second : nullptr);
+        for (size_t w = 0; w < n_windows; ++w) {
+            uint64_t sites;
+            double cost = window_cost(r, w, sites);
+            // cut before this window if stopping here undershoots by less
+            // than taking it would overshoot
+            if (shard.sites > 0
+                && !(blocked && blocked->count(w))
+                && shard.cost + cost > target
+                && shard.cost + cost - target > target - shard.cost) {
+                shard.end = w << BAI_LINEAR_SHIFT;
+                shards.push_back(shard);
+                shard.begin = shard.end;
+                shard.sites = 0;
+                shard.cost = 0;
+            }
+            shard.sites += sites;
+            shard.cost += cost;
+        }
+        // shards never span references, and empty tails are folded into the last shard
+        shard.end = ref.RefLength;
+        if (shard.sites > 0) {
+            shards.push_back(shard);
+        } else if (!shards.empty() && shards.back().seq_name == ref.RefName) {
+            shards.back().end = ref.RefLength;
+        }
+    }
+
+    return shards;
+}
+
+void printPlanUsage(int argc, char** argv) {
+    cerr << "usage: " << argv[0] << " [options] -b FILE -v FILE >manifest.tsv" << endl
+         << endl
+         << "options:" << endl
+         << "    -h, --help            this dialog" << endl
+         << "    -b, --bam FILE        estimate depth from the index of this BAM (multiple allowed)" << endl
+         << "    -v, --vcf FILE        the candidate VCF that hhga will be run on" << endl
+         << "    -n, --shards N        target this many shards of equal estimated cost (default: 64)" << endl
+         << "    -c, --site-cost N     fixed cost per candidate, in compressed BAM bytes (default: 4096)" << endl
+         << "    -o, --prefix PREFIX   name the shard outputs PREFIX.N (default: hhga)" << endl
+         << "    -x, --suffix SUFFIX   append SUFFIX to the shard output names (default: .vw)" << endl
+         << endl
+         << "Writes a manifest of regions with roughly equal estimated cost, one shard per line," << endl
+         << "with the contigs in the order of the VCF. Every contig with candidates must be in" << endl
+         << "the BAM header. Run hhga with -r on each region, writing to the output column, then" << endl
+         << "use hhga merge." << endl;
+}
+
+int main_plan(int argc, char** argv) {
+
+    vector<string> inputFilenames;
+    string vcf_file_name;
+    string prefix = "hhga";
+    string suffix = ".vw";
+    int shard_count = 64;
+    double site_cost = 4096;
+
+    int c;
+    optind = 1;
+    while (true) {
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"bam",  required_argument, 0, 'b'},
+            {"vcf", required_argument, 0, 'v'},
+            {"shards", required_argument, 0, 'n'},
+            {"site-cost", required_argument, 0, 'c'},
+            {"prefix", required_argument, 0, 'o'},
+            {"suffix", required_argument, 0, 'x'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+        c = getopt_long (argc, argv, "hb:v:n:c:o:x:",
+                         long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            inputFilenames.push_back(optarg);
+            break;
+        case 'v':
+            vcf_file_name = optarg;
+            break;
+        case 'n':
+            shard_count = max(1, atoi(optarg));
+            break;
+        case 'c':
+            site_cost = atof(optarg);
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'x':
+            suffix = optarg;
+            break;
+        case 'h':
+        case '?':
+            printPlanUsage(argc, argv);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    if (inputFilenames.empty() || vcf_file_name.empty()) {
+        printPlanUsage(argc, argv);
+        return 1;
+    }
+
+    // the same reader set_region uses, so we agree on reference ids
+    BamTools::BamMultiReader bam_reader;
+    if (!bam_reader.Open(inputFilenames)) {
+        cerr << "could not open input BAM files" << endl;
+        return 1;
+    }
+    if (!bam_reader.LocateIndexes()) {
+        cerr << "[hhga plan] could not load BAM index" << endl;
+        return 1;
+    }
+    auto bam_references = bam_reader.GetReferenceData();
+    vector<vector<uint64_t> > bam_window_bytes;
+    for (auto& bam_file : bam_reader.Filenames()) {
+        auto bai = bai_for_bam(bam_file);
+        if (bai.empty() || !bai_window_bytes(bai, bam_window_bytes)) {
+            cerr << "[hhga plan] could not read the BAM index for " << bam_file << endl;
+            return 1;
+        }
+    }
+
+    // candidate density
+    vcflib::VariantCallFile vcf_file;
+    vcf_file.open(vcf_file_name);
+    if (!vcf_file.is_open()) {
+        cerr << "could not open " << vcf_file_name << endl;
+        return 1;
+    }
+    map<string, vector<uint64_t> > window_sites;
+    map<string, set<size_t> > no_cut;
+    // the contigs in the order of the VCF, which an unsharded run writes them in
+    vector<string> contigs;
+    vcflib::Variant var(vcf_file);
+    while (vcf_file.getNextVariant(var)) {
+        if (!window_sites.count(var.sequenceName)) {
+            contigs.push_back(var.sequenceName);
+        }
+        auto& sites = window_sites[var.sequenceName];
+        size_t w = (var.position-1) >> BAI_LINEAR_SHIFT;
+        if (sites.size() <= w) sites.resize(w+1, 0);
+        ++sites[w];
+        size_t last_w = (var.position-1 + max((size_t)1, var.ref.size()) - 1) >> BAI_LINEAR_SHIFT;
+        for (size_t b = w + 1; b <= last_w; ++b) {
+            no_cut[var.sequenceName].insert(b);
+        }
+    }
+
+    // hhga -r needs the contig in the BAM header, so its candidates could not be run
+    BamTools::RefVector references;
+    vector<vector<uint64_t> > window_bytes;
+    for (auto& contig : contigs) {
+        int ref_id = bam_reader.GetReferenceID(contig);
+        if (ref_id < 0) {
+            cerr << "[hhga plan] " << contig << " has candidates in " << vcf_file_name
+                 << " but is not in the BAM header" << endl;
+            return 1;
+        }
+        references.push_back(bam_references[ref_id]);
+        window_bytes.push_back(ref_id < bam_window_bytes.size()
+                               ? bam_window_bytes[ref_id] : vector<uint64_t>());
+    }
+
+    auto shards = plan_shards(references, window_bytes, window_sites, no_cut,
+                              shard_count, site_cost);
+
+    cout << "#shard\tregion\tsites\tcost\toutput" << endl;
+    int i = 0;
+    for (auto& shard : shards) {
+        stringstream output;
+        output << prefix << "." << setfill('0') << setw(4) << i << suffix;
+        cout << i << "\t"
+             << shard.region() << "\t"
+             << shard.sites << "\t"
+             << (uint64_t) shard.cost << "\t"
+             << output.str() << endl;
+        ++i;
+    }
+
+    return 0;
+}
+
+void printMergeUsage(int argc, char** argv) {
+    cerr << "usage: " << argv[0] << " manifest.tsv >merged" << endl
+         << endl
+         << "Concatenates the shard outputs named in a manifest from hhga plan, in its order." << endl;
+}
+
+int main_merge(int argc, char** argv) {
+
+    if (argc != 2 || string(argv[1]) == "-h" || string(argv[1]) == "--help") {
+        printMergeUsage(argc, argv);
+        return argc == 2 ? 0 : 1;
+    }
+
+    ifstream manifest(argv[1]);
+    if (!manifest.good()) {
+        cerr << "could not open " << argv[1] << endl;
+        return 1;
+    }
+
+    // the manifest is written in the order of the VCF, so we only need to follow it
+    // compressed outputs concatenate byte-wise, as gzip and bgzf allow multiple members
+    vector<string> outputs;
+    for (std::string line; std::getline(manifest, line); ) {
+        if (line.empty() || line[0] == '#') continue;
+        auto fields = split_delims(line, "\t");
+        if (fields.size() < 5) {
+            cerr << "[hhga merge] malformed manifest line -- " << line << endl;
+            return 1;
+        }
+        outputs.push_back(fields[4]);
+    }
+    for (auto& output : outputs) {
+        if (!ifstream(output).good()) {
+            cerr << "[hhga merge] missing shard output " << output << endl;
+            return 1;
+        }
+    }
+    for (auto& output : outputs) {
+        ifstream in(output, ios::in | ios::binary);
+        if (in.peek() != ifstream::traits_type::eof()) {
+            cout << in.rdbuf();
+        }
+    }
+    cout.flush();
+
+    return 0;
+}
+
+}
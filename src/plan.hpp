@@ -0,0 +1,47 @@
+#ifndef HHGA_PLAN_H
+#define HHGA_PLAN_H
+
+#include "hhga.hpp"
+#include <fstream>
+
+namespace hhga {
+
+using namespace std;
+
+// the BAM linear index tracks one offset per 16kb window
+#define BAI_LINEAR_SHIFT 14
+// the pseudo-bin holding per-reference offsets and counts
+#define BAI_PSEUDO_BIN 37450
+
+// a contiguous piece of one reference sequence to be processed as a unit
+class shard_t {
+public:
+    string seq_name;
+    int32_t begin; // 0-based
+    int32_t end;   // end-exclusive
+    uint64_t sites;
+    double cost;
+    // 1-based and inclusive, as taken by --region
+    const string region(void) const;
+};
+
+string bai_for_bam(const string& bam_file);
+// compressed bytes of alignments in each linear index window, per reference id
+bool bai_window_bytes(const string& bai_file, vector<vector<uint64_t> >& bytes);
+// cut the references into shards of approximately equal estimated cost, kept in their order
+// window_bytes is indexed as references
+// no cut is made at the start of a window in no_cut, so that a candidate
+// spanning the boundary is not returned for both of the adjoining regions
+vector<shard_t> plan_shards(const BamTools::RefVector& references,
+                            const vector<vector<uint64_t> >& window_bytes,
+                            const map<string, vector<uint64_t> >& window_sites,
+                            const map<string, set<size_t> >& no_cut,
+                            int shard_count,
+                            double site_cost);
+
+int main_plan(int argc, char** argv);
+int main_merge(int argc, char** argv);
+
+}
+
+#endif
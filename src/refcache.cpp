@@ -0,0 +1,244 @@
+#include "refcache.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace hhga {
+
+static const char refcache_bases[4] = { 'A', 'C', 'G', 'T' };
+
+static int base_code(char c) {
+    switch (c) {
+    case 'A': case 'a': return 0;
+    case 'C': case 'c': return 1;
+    case 'G': case 'g': return 2;
+    case 'T': case 't': return 3;
+    default: return -1;
+    }
+}
+
+ref_view_t::ref_view_t(const refcache_entry_t* e, const char* b, uint64_t s, uint64_t l)
+    : entry(e), base(b), start(s), len(l), plain(true) {
+    // runs and masks are sorted and disjoint, so checking the last one
+    // starting before the end of the view is enough
+    auto overlaps = [&](uint64_t rstart, uint64_t rlen) {
+        return rstart < start + len && rstart + rlen > start;
+    };
+    auto runs = (const refcache_run_t*)(base + entry->runs_offset);
+    auto r = std::upper_bound(runs, runs + entry->run_count, start + len,
+                              [](uint64_t p, const refcache_run_t& run) { return p <= run.start; });
+    if (r != runs && overlaps((r-1)->start, (r-1)->length)) plain = false;
+    auto masks = (const refcache_mask_t*)(base + entry->masks_offset);
+    auto m = std::upper_bound(masks, masks + entry->mask_count, start + len,
+                              [](uint64_t p, const refcache_mask_t& mask) { return p <= mask.start; });
+    if (m != masks && overlaps((m-1)->start, (m-1)->length)) plain = false;
+}
+
+char ref_view_t::decode(uint64_t pos) const {
+    auto packed = (const uint8_t*)(base + entry->packed_offset);
+    char c = refcache_bases[(packed[pos >> 2] >> ((3 - (pos & 3)) * 2)) & 3];
+    if (plain) return c;
+    auto runs = (const refcache_run_t*)(base + entry->runs_offset);
+    auto r = std::upper_bound(runs, runs + entry->run_count, pos,
+                              [](uint64_t p, const refcache_run_t& run) { return p < run.start; });
+    if (r != runs && pos < (r-1)->start + (r-1)->length) c = (char)(r-1)->base;
+    auto masks = (const refcache_mask_t*)(base + entry->masks_offset);
+    auto m = std::upper_bound(masks, masks + entry->mask_count, pos,
+                              [](uint64_t p, const refcache_mask_t& mask) { return p < mask.start; });
+    if (m != masks && pos < (m-1)->start + (m-1)->length) c = tolower(c);
+    return c;
+}
+
+char ref_view_t::operator[](size_t i) const {
+    return decode(start + i);
+}
+
+const string ref_view_t::substr(size_t pos, size_t n) const {
+    n = min(n, len - min((uint64_t)pos, len));
+    string s(n, ' ');
+    for (size_t i = 0; i < n; ++i) {
+        s[i] = decode(start + pos + i);
+    }
+    return s;
+}
+
+const string ref_view_t::str(void) const {
+    return substr(0, len);
+}
+
+ReferenceCache::~ReferenceCache(void) {
+    if (data) munmap((void*)data, data_size);
+}
+
+bool ReferenceCache::build(const string& fasta_file, const string& cache_file) {
+    FastaReference fasta_ref;
+    fasta_ref.open(fasta_file);
+
+    // write to a private file and rename, so concurrent builders never see a partial cache
+    stringstream tmp;
+    tmp << cache_file << ".tmp." << getpid();
+    ofstream out(tmp.str(), ios::out | ios::binary);
+    if (!out.good()) {
+        cerr << "[hhga] could not write reference cache " << tmp.str() << endl;
+        return false;
+    }
+
+    auto& names = fasta_ref.index->sequenceNames;
+    vector<refcache_entry_t> table(names.size());
+    uint64_t offset = sizeof(refcache_header_t) + table.size() * sizeof(refcache_entry_t);
+    refcache_header_t header;
+    memcpy(header.magic, REFCACHE_MAGIC, 8);
+    header.seq_count = names.size();
+    out.write((const char*)&header, sizeof(header));
+    // reserve the table, which we fill in once the offsets are known
+    out.write((const char*)table.data(), table.size() * sizeof(refcache_entry_t));
+
+    auto pad = [&](void) {
+        static const char zeros[8] = { 0 };
+        if (offset % 8) {
+            out.write(zeros, 8 - offset % 8);
+            offset += 8 - offset % 8;
+        }
+    };
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        auto& e = table[i];
+        auto& name = names[i];
+        string seq = fasta_ref.getSequence(name);
+        e.length = seq.size();
+        e.name_offset = offset;
+        e.name_length = name.size();
+        out.write(name.c_str(), name.size());
+        offset += name.size();
+        pad();
+
+        vector<uint8_t> packed((seq.size() + 3) / 4, 0);
+        vector<refcache_run_t> runs;
+        vector<refcache_mask_t> masks;
+        for (uint64_t p = 0; p < seq.size(); ++p) {
+            char c = seq[p];
+            int code = base_code(c);
+            if (code < 0) {
+                char u = toupper(c);
+                if (!runs.empty()
+                    && runs.back().base == (uint64_t)u
+                    && runs.back().start + runs.back().length == p) {
+                    ++runs.back().length;
+                } else {
+                    refcache_run_t run = { p, 1, (uint64_t)u };
+                    runs.push_back(run);
+                }
+                code = 0;
+            }
+            if (islower(c)) {
+                if (!masks.empty() && masks.back().start + masks.back().length == p) {
+                    ++masks.back().length;
+                } else {
+                    refcache_mask_t mask = { p, 1 };
+                    masks.push_back(mask);
+                }
+            }
+            packed[p >> 2] |= code << ((3 - (p & 3)) * 2);
+        }
+
+        e.packed_offset = offset;
+        out.write((const char*)packed.data(), packed.size());
+        offset += packed.size();
+        pad();
+        e.run_count = runs.size();
+        e.runs_offset = offset;
+        out.write((const char*)runs.data(), runs.size() * sizeof(refcache_run_t));
+        offset += runs.size() * sizeof(refcache_run_t);
+        e.mask_count = masks.size();
+        e.masks_offset = offset;
+        out.write((const char*)masks.data(), masks.size() * sizeof(refcache_mask_t));
+        offset += masks.size() * sizeof(refcache_mask_t);
+    }
+
+    out.seekp(sizeof(refcache_header_t));
+    out.write((const char*)table.data(), table.size() * sizeof(refcache_entry_t));
+    out.close();
+    if (!out.good() || rename(tmp.str().c_str(), cache_file.c_str()) != 0) {
+        cerr << "[hhga] could not write reference cache " << cache_file << endl;
+        unlink(tmp.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ReferenceCache::open(const string& fasta_file) {
+    string cache_file = fasta_file + REFCACHE_SUFFIX;
+    struct stat fasta_stat, cache_stat;
+    if (stat(fasta_file.c_str(), &fasta_stat) != 0) {
+        cerr << "[hhga] could not open " << fasta_file << endl;
+        return false;
+    }
+    if (stat(cache_file.c_str(), &cache_stat) != 0
+        || cache_stat.st_mtime < fasta_stat.st_mtime) {
+        if (!build(fasta_file, cache_file)) return false;
+        stat(cache_file.c_str(), &cache_stat);
+    }
+
+    int fd = ::open(cache_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "[hhga] could not open reference cache " << cache_file << endl;
+        return false;
+    }
+    data_size = cache_stat.st_size;
+    void* mapped = mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "[hhga] could not map reference cache " << cache_file << endl;
+        data_size = 0;
+        return false;
+    }
+    data = (const char*)mapped;
+
+    auto header = (const refcache_header_t*)data;
+    if (data_size < sizeof(refcache_header_t)
+        || memcmp(header->magic, REFCACHE_MAGIC, 8) != 0) {
+        cerr << "[hhga] " << cache_file << " is not an hhga reference cache, remove it to rebuild" << endl;
+        return false;
+    }
+    auto table = (const refcache_entry_t*)(data + sizeof(refcache_header_t));
+    for (uint64_t i = 0; i < header->seq_count; ++i) {
+        entries[string(data + table[i].name_offset, table[i].name_length)] = &table[i];
+    }
+    return true;
+}
+
+const refcache_entry_t* ReferenceCache::entry(const string& seq_name) const {
+    auto f = entries.find(seq_name);
+    if (f == entries.end()) {
+        cerr << "unable to find FASTA index entry for '" << seq_name << "'" << endl;
+        exit(1);
+    }
+    return f->second;
+}
+
+ref_view_t ReferenceCache::view(const string& seq_name, int start, int length) const {
+    auto e = entry(seq_name);
+    length = min(length, (int)(e->length - start));
+    if (start < 0 || length < 1) {
+        cerr << "Error: cannot construct subsequence with negative offset or length < 1" << endl;
+        exit(1);
+    }
+    return ref_view_t(e, data, start, length);
+}
+
+const string ReferenceCache::getSubSequence(const string& seq_name, int start, int length) const {
+    return view(seq_name, start, length).str();
+}
+
+uint64_t ReferenceCache::sequenceLength(const string& seq_name) const {
+    return entry(seq_name)->length;
+}
+
+}
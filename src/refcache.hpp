@@ -0,0 +1,87 @@
+#ifndef HHGA_REFCACHE_H
+#define HHGA_REFCACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Fasta.h"
+
+namespace hhga {
+
+using namespace std;
+
+#define REFCACHE_MAGIC "HHGAREF1"
+#define REFCACHE_SUFFIX ".hhref"
+
+// on-disk layout, all offsets are from the start of the file
+struct refcache_header_t {
+    char magic[8];
+    uint64_t seq_count;
+};
+
+struct refcache_entry_t {
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t length;
+    uint64_t packed_offset; // 2 bits per base, A=0 C=1 G=2 T=3, first base in the high bits
+    uint64_t run_count;     // runs of bases that are not ACGT, typically N
+    uint64_t runs_offset;
+    uint64_t mask_count;    // runs of lower-case (soft-masked) sequence
+    uint64_t masks_offset;
+};
+
+struct refcache_run_t {
+    uint64_t start;
+    uint64_t length;
+    uint64_t base;
+};
+
+struct refcache_mask_t {
+    uint64_t start;
+    uint64_t length;
+};
+
+// a window of a cached sequence, decoded on access without copying
+class ref_view_t {
+public:
+    ref_view_t(void) : entry(nullptr), base(nullptr), start(0), len(0), plain(true) { }
+    ref_view_t(const refcache_entry_t* e, const char* b, uint64_t s, uint64_t l);
+    char operator[](size_t i) const;
+    size_t size(void) const { return len; }
+    const string str(void) const;
+    const string substr(size_t pos, size_t n) const;
+private:
+    const refcache_entry_t* entry;
+    const char* base; // the start of the mapped file
+    uint64_t start;
+    uint64_t len;
+    bool plain; // no runs or masks overlap the view
+    char decode(uint64_t pos) const;
+};
+
+// a memory-mapped, 2-bit packed copy of a FASTA file
+// the cache is built next to the FASTA on first use, using its .fai,
+// and mapped shared and read-only so that processes on a node share one copy
+class ReferenceCache {
+public:
+    ReferenceCache(void) : data(nullptr), data_size(0) { }
+    ReferenceCache(const ReferenceCache&) = delete;
+    ~ReferenceCache(void);
+    bool open(const string& fasta_file);
+    bool is_open(void) const { return data != nullptr; }
+    // equivalent to FastaReference::getSubSequence, including its bounds checks
+    ref_view_t view(const string& seq_name, int start, int length) const;
+    const string getSubSequence(const string& seq_name, int start, int length) const;
+    uint64_t sequenceLength(const string& seq_name) const;
+    static bool build(const string& fasta_file, const string& cache_file);
+private:
+    const char* data;
+    size_t data_size;
+    map<string, const refcache_entry_t*> entries;
+    const refcache_entry_t* entry(const string& seq_name) const;
+};
+
+}
+
+#endif
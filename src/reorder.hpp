@@ -0,0 +1,72 @@
+#ifndef HHGA_REORDER_H
+#define HHGA_REORDER_H
+
+#include <map>
+#include <string>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+
+namespace hhga {
+
+using namespace std;
+
+// collects the output of sites that finish out of order and writes it
+// in the order the sites were read, so that threaded runs match serial ones
+// records are gathered into blocks of block_size bytes before they are written
+class ReorderBuffer {
+public:
+    ReorderBuffer(ostream& o, size_t max_pending = 1024, size_t block_size = 1 << 20)
+        : out(o), next_id(0), max_pending(max_pending), block_size(block_size) {
+        block.reserve(block_size * 2);
+    }
+
+    // blocks while id is too far ahead of the next unwritten record,
+    // which bounds the memory held for results waiting on a slow site
+    // the record is consumed, leaving it empty so the caller can reuse it
+    void write(size_t id, string& record) {
+        unique_lock<mutex> lock(mtx);
+        ready.wait(lock, [&](void) { return id < next_id + max_pending; });
+        if (id == next_id) {
+            // the usual case, which only copies into the block
+            block.append(record);
+            record.clear();
+            ++next_id;
+        } else {
+            pending[id] = std::move(record);
+            record.clear();
+        }
+        auto p = pending.begin();
+        while (p != pending.end() && p->first == next_id) {
+            block.append(p->second);
+            p = pending.erase(p);
+            ++next_id;
+        }
+        if (block.size() >= block_size) {
+            out.write(block.data(), block.size());
+            block.clear();
+        }
+        ready.notify_all();
+    }
+
+    void flush(void) {
+        lock_guard<mutex> lock(mtx);
+        out.write(block.data(), block.size());
+        block.clear();
+        out.flush();
+    }
+
+private:
+    ostream& out;
+    size_t next_id;
+    size_t max_pending;
+    size_t block_size;
+    string block;
+    map<size_t, string> pending;
+    mutex mtx;
+    condition_variable ready;
+};
+
+}
+
+#endif
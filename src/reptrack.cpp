@@ -0,0 +1,278 @@
+#include "reptrack.hpp"
+#include "hhga.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cstdlib>
+#include <getopt.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace hhga {
+
+// sites are scanned in blocks of this many, each written as soon as it is done
+#define REPTRACK_BLOCK (1 << 20)
+
+RepeatTrack::~RepeatTrack(void) {
+    if (data) munmap((void*)data, data_size);
+}
+
+static bool write_at(int fd, const void* buf, size_t n, uint64_t offset) {
+    auto p = (const char*)buf;
+    while (n) {
+        ssize_t w = pwrite(fd, p, n, offset);
+        if (w <= 0) return false;
+        p += w;
+        n -= w;
+        offset += w;
+    }
+    return true;
+}
+
+bool RepeatTrack::build(const string& fasta_file, const string& track_file,
+                        size_t window_length, double min_entropy, int threads) {
+    FastaReference fasta_ref;
+    fasta_ref.open(fasta_file);
+    auto& names = fasta_ref.index->sequenceNames;
+
+    // write to a private file and rename, so concurrent builders never see a partial track
+    stringstream tmp;
+    tmp << track_file << ".tmp." << getpid();
+    int fd = ::open(tmp.str().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "[hhga] could not write repeat track " << tmp.str() << endl;
+        return false;
+    }
+
+    // the spans of each sequence have a fixed size, so the threads write them in place,
+    // and the exceptions, only counted at the end, follow them
+    int repeat_window_length = window_length * 8;
+    uint64_t half = repeat_window_length/2;
+    auto pad = [](uint64_t offset) { return (offset + 7) / 8 * 8; };
+    vector<reptrack_entry_t> table(names.size());
+    uint64_t offset = sizeof(reptrack_header_t) + table.size() * sizeof(reptrack_entry_t);
+    bool ok = true;
+    for (size_t i = 0; i < names.size(); ++i) {
+        auto& e = table[i];
+        e.length = fasta_ref.sequenceLength(names[i]);
+        e.name_offset = offset;
+        e.name_length = names[i].size();
+        ok = ok && write_at(fd, names[i].c_str(), names[i].size(), offset);
+        offset = pad(offset + names[i].size());
+        e.first = min(half, e.length);
+        e.spans_offset = offset;
+        offset = pad(offset + 2 * (e.length - e.first));
+    }
+
+    // the longest sequences first, so none is left running alone at the end
+    vector<size_t> order(names.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return table[a].length > table[b].length;
+        });
+    vector<vector<reptrack_exception_t> > exceptions(names.size());
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+    for (size_t k = 0; k < order.size(); ++k) {
+        size_t i = order[k];
+        auto& e = table[i];
+        // each thread reads its own sequence, as the reader seeks
+        FastaReference thread_ref;
+        thread_ref.open(fasta_file);
+        string seq = thread_ref.getSequence(names[i]);
+        vector<uint8_t> spans;
+        for (uint64_t block = e.first; block < e.length; block += REPTRACK_BLOCK) {
+            uint64_t block_end = min(block + REPTRACK_BLOCK, e.length);
+            spans.clear();
+            for (uint64_t pos = block; pos < block_end; ++pos) {
+                // the repeat window as HHGA::HHGA fetches it, truncated at the end of the sequence
+                int repeat_window_start = pos - half;
+                auto f = site_callable_window(seq.substr(repeat_window_start, repeat_window_length),
+                                              repeat_window_start,
+                                              repeat_window_length,
+                                              min_entropy);
+                int64_t before = (int64_t)pos+1 - f.first;
+                int64_t after = f.second - ((int64_t)pos+1);
+                if (before < REPTRACK_EXCEPTION && after < REPTRACK_EXCEPTION) {
+                    spans.push_back(before);
+                    spans.push_back(after);
+                } else {
+                    spans.push_back(REPTRACK_EXCEPTION);
+                    spans.push_back(REPTRACK_EXCEPTION);
+                    exceptions[i].push_back(reptrack_exception_t{ pos, f.first, f.second });
+                }
+            }
+            if (!write_at(fd, spans.data(), spans.size(), e.spans_offset + 2 * (block - e.first))) {
+#pragma omp critical (reptrack_error)
+                ok = false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        auto& e = table[i];
+        e.exception_count = exceptions[i].size();
+        e.exceptions_offset = offset;
+        ok = ok && write_at(fd, exceptions[i].data(),
+                            exceptions[i].size() * sizeof(reptrack_exception_t), offset);
+        offset += exceptions[i].size() * sizeof(reptrack_exception_t);
+    }
+    reptrack_header_t header;
+    memcpy(header.magic, REPTRACK_MAGIC, 8);
+    header.seq_count = names.size();
+    header.window_length = window_length;
+    header.min_entropy = min_entropy;
+    ok = ok && write_at(fd, &header, sizeof(header), 0)
+        && write_at(fd, table.data(), table.size() * sizeof(reptrack_entry_t), sizeof(header));
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || rename(tmp.str().c_str(), track_file.c_str()) != 0) {
+        cerr << "[hhga] could not write repeat track " << track_file << endl;
+        unlink(tmp.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RepeatTrack::open(const string& track_file, size_t window_length, double min_entropy) {
+    struct stat track_stat;
+    int fd = ::open(track_file.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &track_stat) != 0) {
+        cerr << "[hhga] could not open repeat track " << track_file << endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    data_size = track_stat.st_size;
+    void* mapped = mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "[hhga] could not map repeat track " << track_file << endl;
+        data_size = 0;
+        return false;
+    }
+    data = (const char*)mapped;
+
+    auto header = (const reptrack_header_t*)data;
+    if (data_size < sizeof(reptrack_header_t)
+        || memcmp(header->magic, REPTRACK_MAGIC, 8) != 0) {
+        cerr << "[hhga] " << track_file << " is not an hhga repeat track" << endl;
+        return false;
+    }
+    // the spans depend on both, so a track for others would give other examples
+    if (header->window_length != window_length || header->min_entropy != min_entropy) {
+        cerr << "[hhga] " << track_file << " was built for --window-size " << header->window_length
+             << " and --min-entropy " << header->min_entropy << ", rebuild it with hhga index-ref" << endl;
+        return false;
+    }
+    auto table = (const reptrack_entry_t*)(data + sizeof(reptrack_header_t));
+    for (uint64_t i = 0; i < header->seq_count; ++i) {
+        entries[string(data + table[i].name_offset, table[i].name_length)] = &table[i];
+    }
+    return true;
+}
+
+bool RepeatTrack::callable(const string& seq_name, int pos, int& begin, int& end) const {
+    auto f = entries.find(seq_name);
+    if (f == entries.end()) return false;
+    auto e = f->second;
+    if (pos < 0 || (uint64_t)pos < e->first || (uint64_t)pos >= e->length) return false;
+    auto spans = (const uint8_t*)(data + e->spans_offset) + 2 * (pos - e->first);
+    if (spans[0] == REPTRACK_EXCEPTION) {
+        auto exceptions = (const reptrack_exception_t*)(data + e->exceptions_offset);
+        auto x = std::lower_bound(exceptions, exceptions + e->exception_count, (uint64_t)pos,
+                                  [](const reptrack_exception_t& x, uint64_t p) { return x.pos < p; });
+        if (x == exceptions + e->exception_count || x->pos != (uint64_t)pos) return false;
+        begin = x->begin;
+        end = x->end;
+    } else {
+        begin = pos+1 - spans[0];
+        end = pos+1 + spans[1];
+    }
+    return true;
+}
+
+void printIndexRefUsage(int argc, char** argv) {
+    cerr << "usage: " << argv[0] << " [options] -f FILE -E X" << endl
+         << endl
+         << "options:" << endl
+         << "    -h, --help                this dialog" << endl
+         << "    -f, --fasta-reference FILE  the reference to scan" << endl
+         << "    -w, --window-size N       the --window-size of the runs using the track (default: 50)" << endl
+         << "    -E, --min-entropy X       the --min-entropy of the runs using the track" << endl
+         << "    -j, --threads N           scan N sequences at a time (default: 1)" << endl
+         << "    -o, --output FILE         write the track to FILE (default: the FASTA with " << REPTRACK_SUFFIX << ")" << endl
+         << endl
+         << "Writes the window reads must span around each site of the reference, given its" << endl
+         << "tandem repeats and entropy, for hhga --repeat-track to look up rather than compute." << endl;
+}
+
+int main_index_ref(int argc, char** argv) {
+
+    string fasta_file;
+    string track_file;
+    size_t window_size = 50;
+    double min_entropy = 0;
+    int threads = 1;
+
+    int c;
+    optind = 1;
+    while (true) {
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"fasta-reference", required_argument, 0, 'f'},
+            {"window-size", required_argument, 0, 'w'},
+            {"min-entropy", required_argument, 0, 'E'},
+            {"threads", required_argument, 0, 'j'},
+            {"output", required_argument, 0, 'o'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+        c = getopt_long (argc, argv, "hf:w:E:j:o:",
+                         long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'f':
+            fasta_file = optarg;
+            break;
+        case 'w':
+            window_size = atoi(optarg);
+            break;
+        case 'E':
+            min_entropy = atof(optarg);
+            break;
+        case 'j':
+            threads = max(1, atoi(optarg));
+            break;
+        case 'o':
+            track_file = optarg;
+            break;
+        case 'h':
+        case '?':
+            printIndexRefUsage(argc, argv);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    // without --min-entropy, hhga does not use the callable window
+    if (fasta_file.empty() || min_entropy <= 0 || window_size == 0) {
+        printIndexRefUsage(argc, argv);
+        return 1;
+    }
+    if (track_file.empty()) {
+        track_file = fasta_file + REPTRACK_SUFFIX;
+    }
+    if (!RepeatTrack::build(fasta_file, track_file, window_size, min_entropy, threads)) {
+        return 1;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef HHGA_REPTRACK_H
+#define HHGA_REPTRACK_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace hhga {
+
+using namespace std;
+
+#define REPTRACK_MAGIC "HHGAREP1"
+#define REPTRACK_SUFFIX ".hhrep"
+
+// on-disk layout, all offsets are from the start of the file
+struct reptrack_header_t {
+    char magic[8];
+    uint64_t seq_count;
+    uint64_t window_length; // the --window-size and --min-entropy the track was built for
+    double min_entropy;
+};
+
+struct reptrack_entry_t {
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t length;
+    uint64_t first;           // sites before this have no repeat window, and are not covered
+    uint64_t spans_offset;    // two bytes for each site from first, before and after
+    uint64_t exception_count; // sites whose span does not fit in the bytes, sorted
+    uint64_t exceptions_offset;
+};
+
+// bytes of a span that are set to this are in the exceptions
+#define REPTRACK_EXCEPTION 255
+
+struct reptrack_exception_t {
+    uint64_t pos;
+    int64_t begin;
+    int64_t end;
+};
+
+// the callable window of each site of a reference, as HHGA::HHGA would compute it from
+// the repeats and entropy of the reference around it, for one window size and --min-entropy
+// a site at 0-based pos gets [pos+1 - before, pos+1 + after), stored as the bytes
+// before and after, so a track takes two bytes per base
+// it is memory-mapped, shared and read-only, so one copy serves all threads and processes
+class RepeatTrack {
+public:
+    RepeatTrack(void) : data(nullptr), data_size(0) { }
+    RepeatTrack(const RepeatTrack&) = delete;
+    ~RepeatTrack(void);
+    // fails if the track was built for another window size or --min-entropy
+    bool open(const string& track_file, size_t window_length, double min_entropy);
+    bool is_open(void) const { return data != nullptr; }
+    // false if the track does not cover the site, which is then computed as before
+    bool callable(const string& seq_name, int pos, int& begin, int& end) const;
+    // scans the sequences of the FASTA on threads, one sequence on each at a time
+    static bool build(const string& fasta_file, const string& track_file,
+                      size_t window_length, double min_entropy, int threads);
+private:
+    const char* data;
+    size_t data_size;
+    map<string, const reptrack_entry_t*> entries;
+};
+
+int main_index_ref(int argc, char** argv);
+
+}
+
+#endif
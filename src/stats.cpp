@@ -0,0 +1,144 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <cmath>
+
+namespace hhga {
+
+const char* stage_names[STAGE_COUNT] = {
+    "setup",
+    "graph_build",
+    "fetch",
+    "graph_align",
+    "decode",
+    "msa",
+    "match",
+    "likelihood",
+    "group",
+    "format"
+};
+
+void RunStats::totals_t::add(const site_stats_t& site) {
+    ++sites;
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        stages[s].wall += site.stages[s].wall;
+        stages[s].cpu += site.stages[s].cpu;
+    }
+    reads_fetched += site.reads_fetched;
+    reads_kept += site.reads_kept;
+    unitigs += site.unitigs;
+    graph_alignments += site.graph_alignments;
+    msa_width += site.msa_width;
+    max_msa_width = max(max_msa_width, site.msa_width);
+    msa_depth += site.msa_depth;
+    max_msa_depth = max(max_msa_depth, site.msa_depth);
+    bytes += site.bytes;
+    latencies.push_back(site.wall);
+}
+
+void RunStats::totals_t::merge(const totals_t& other) {
+    sites += other.sites;
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        stages[s].wall += other.stages[s].wall;
+        stages[s].cpu += other.stages[s].cpu;
+    }
+    reads_fetched += other.reads_fetched;
+    reads_kept += other.reads_kept;
+    unitigs += other.unitigs;
+    graph_alignments += other.graph_alignments;
+    msa_width += other.msa_width;
+    max_msa_width = max(max_msa_width, other.max_msa_width);
+    msa_depth += other.msa_depth;
+    max_msa_depth = max(max_msa_depth, other.max_msa_depth);
+    bytes += other.bytes;
+    latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+}
+
+// contig names come from the VCF, so they are escaped for JSON
+static string json_string(const string& s) {
+    string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            r.push_back('\\');
+            r.push_back(c);
+        } else if ((unsigned char)c < 0x20) {
+            r.push_back(' ');
+        } else {
+            r.push_back(c);
+        }
+    }
+    r.push_back('"');
+    return r;
+}
+
+// the fields of an object, without its braces or a final newline
+void RunStats::totals_t::write_json(ostream& out, const string& indent) const {
+    out << indent << "\"sites\": " << sites << "," << endl
+        << indent << "\"stages\": {" << endl;
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        out << indent << "  " << json_string(stage_names[s])
+            << ": { \"wall\": " << stages[s].wall
+            << ", \"cpu\": " << stages[s].cpu << " }"
+            << (s + 1 < STAGE_COUNT ? "," : "") << endl;
+    }
+    out << indent << "}," << endl
+        << indent << "\"reads_fetched\": " << reads_fetched << "," << endl
+        << indent << "\"reads_kept\": " << reads_kept << "," << endl
+        << indent << "\"unitigs\": " << unitigs << "," << endl
+        << indent << "\"graph_alignments\": " << graph_alignments << "," << endl
+        << indent << "\"msa_width\": { \"mean\": " << (sites ? (double)msa_width / sites : 0)
+        << ", \"max\": " << max_msa_width << " }," << endl
+        << indent << "\"msa_depth\": { \"mean\": " << (sites ? (double)msa_depth / sites : 0)
+        << ", \"max\": " << max_msa_depth << " }," << endl
+        << indent << "\"bytes\": " << bytes << "," << endl;
+    // nearest-rank percentiles of the time each site took
+    vector<float> sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) -> double {
+        if (sorted.empty()) return 0;
+        size_t rank = (size_t)ceil(p / 100 * sorted.size());
+        return sorted[max(rank, (size_t)1) - 1];
+    };
+    out << indent << "\"site_seconds\": { "
+        << "\"p50\": " << percentile(50) << ", "
+        << "\"p90\": " << percentile(90) << ", "
+        << "\"p99\": " << percentile(99) << ", "
+        << "\"max\": " << (sorted.empty() ? 0 : sorted.back()) << " }";
+}
+
+void RunStats::add(const string& contig, const site_stats_t& site) {
+    contigs[contig].add(site);
+}
+
+void RunStats::merge(const RunStats& other) {
+    for (auto& c : other.contigs) {
+        contigs[c.first].merge(c.second);
+    }
+}
+
+void RunStats::write_json(ostream& out, double wall, double cpu, int threads) const {
+    totals_t all;
+    for (auto& c : contigs) {
+        all.merge(c.second);
+    }
+    out << setprecision(6)
+        << "{" << endl
+        << "  \"threads\": " << threads << "," << endl
+        << "  \"wall\": " << wall << "," << endl
+        << "  \"cpu\": " << cpu << "," << endl;
+    all.write_json(out, "  ");
+    out << "," << endl
+        << "  \"contigs\": {" << endl;
+    bool first = true;
+    for (auto& c : contigs) {
+        if (!first) out << "," << endl;
+        first = false;
+        out << "    " << json_string(c.first) << ": {" << endl;
+        c.second.write_json(out, "      ");
+        out << endl << "    }";
+    }
+    out << endl << "  }" << endl
+        << "}" << endl;
+}
+
+}
@@ -0,0 +1,134 @@
+#ifndef HHGA_STATS_H
+#define HHGA_STATS_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <time.h>
+
+namespace hhga {
+
+using namespace std;
+
+// the stages of building an example, in the order a site passes through them
+enum stage_t {
+    STAGE_SETUP,       // windows, reference and repeat entropy
+    STAGE_GRAPH_BUILD, // the site's variation graph
+    STAGE_FETCH,       // reading alignments from the BAMs
+    STAGE_GRAPH_ALIGN, // aligning the graph window's reads to the graph
+    STAGE_DECODE,      // turning CIGARs into alleles
+    STAGE_MSA,         // haplotypes, filtering, projection and padding
+    STAGE_MATCH,       // packing the MSA and matching reads to haplotypes
+    STAGE_LIKELIHOOD,  // genotype likelihoods
+    STAGE_GROUP,       // grouping reads by the allele they support
+    STAGE_FORMAT,      // writing the example
+    STAGE_COUNT
+};
+
+extern const char* stage_names[STAGE_COUNT];
+
+// seconds
+struct stage_time_t {
+    double wall = 0;
+    double cpu = 0;
+};
+
+// what one site cost, filled in by HHGA and the main loop
+struct site_stats_t {
+    stage_time_t stages[STAGE_COUNT];
+    uint64_t reads_fetched = 0;    // in the window, before filtering and --downsample
+    uint64_t reads_kept = 0;
+    uint64_t unitigs = 0;
+    uint64_t graph_alignments = 0;
+    uint64_t msa_width = 0;        // columns of the projected alignment, before windowing
+    uint64_t msa_depth = 0;        // rows
+    uint64_t bytes = 0;            // of the example written
+    double wall = 0;               // the whole site
+};
+
+inline double wall_seconds(void) {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+inline double thread_cpu_seconds(void) {
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+inline double process_cpu_seconds(void) {
+    timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// charges the time of a site to whichever stage is current
+// a stage nested in another, such as aligning reads while they are fetched,
+// is entered and left again, so no time is counted twice
+// without stats, it does nothing
+class stage_clock_t {
+public:
+    stage_clock_t(site_stats_t* stats, stage_t stage) : stats(stats), stage(stage) {
+        if (stats) start();
+    }
+    ~stage_clock_t(void) { stop(); }
+    void enter(stage_t next) {
+        if (!stats) return;
+        stop();
+        stage = next;
+        start();
+    }
+    void stop(void) {
+        if (!stats || !running) return;
+        stats->stages[stage].wall += wall_seconds() - wall;
+        stats->stages[stage].cpu += thread_cpu_seconds() - cpu;
+        running = false;
+    }
+private:
+    site_stats_t* stats;
+    stage_t stage;
+    bool running = false;
+    double wall = 0;
+    double cpu = 0;
+    void start(void) {
+        wall = wall_seconds();
+        cpu = thread_cpu_seconds();
+        running = true;
+    }
+};
+
+// the sites of one thread, by contig, merged into a JSON report at exit
+class RunStats {
+public:
+    void add(const string& contig, const site_stats_t& site);
+    void merge(const RunStats& other);
+    // wall and cpu are those of the whole run
+    void write_json(ostream& out, double wall, double cpu, int threads) const;
+private:
+    struct totals_t {
+        uint64_t sites = 0;
+        stage_time_t stages[STAGE_COUNT];
+        uint64_t reads_fetched = 0;
+        uint64_t reads_kept = 0;
+        uint64_t unitigs = 0;
+        uint64_t graph_alignments = 0;
+        uint64_t msa_width = 0;
+        uint64_t max_msa_width = 0;
+        uint64_t msa_depth = 0;
+        uint64_t max_msa_depth = 0;
+        uint64_t bytes = 0;
+        vector<float> latencies; // the wall time of each site
+        void add(const site_stats_t& site);
+        void merge(const totals_t& other);
+        void write_json(ostream& out, const string& indent) const;
+    };
+    map<string, totals_t> contigs;
+};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "sweep.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace hhga {
+
+void SweepReader::seek(int32_t pos) {
+    buffer.clear();
+    if (!reader.LocateIndexes()) {
+        cerr << "[hhga] could not load BAM index" << endl;
+        exit(1);
+    }
+    auto references = reader.GetReferenceData();
+    ref_id = reader.GetReferenceID(seq_name);
+    if (ref_id < 0) {
+        // nothing to read, as with a region on an unknown sequence
+        exhausted = true;
+    } else {
+        reader.SetRegion(ref_id, pos, ref_id, references[ref_id].RefLength);
+        exhausted = false;
+    }
+    low_water = pos;
+    loaded_to = pos - 1;
+}
+
+void SweepReader::advance(const string& name, int32_t pos) {
+    if (name != seq_name
+        || pos < low_water
+        || pos > loaded_to + SWEEP_MAX_GAP) {
+        seq_name = name;
+        seek(pos);
+        return;
+    }
+    low_water = pos;
+    // reads are sorted by start, not end, so a long read can shadow shorter ones
+    buffer.erase(std::remove_if(buffer.begin(), buffer.end(),
+                                [&](const BamTools::BamAlignment& aln) {
+                                    return aln.GetEndPosition(false, true) < pos;
+                                }),
+                 buffer.end());
+}
+
+void SweepReader::fill(int32_t end) {
+    BamTools::BamAlignment aln;
+    while (!exhausted && loaded_to <= end) {
+        if (reader.GetNextAlignment(aln) && aln.RefID == ref_id) {
+            loaded_to = aln.Position;
+            if (aln.GetEndPosition(false, true) >= low_water
+                || aln.Position >= low_water) {
+                buffer.push_back(aln);
+            }
+        } else {
+            exhausted = true;
+        }
+    }
+}
+
+void SweepReader::for_each_overlap(int32_t begin, int32_t end,
+                                   const function<void(BamTools::BamAlignment&)>& lambda) {
+    if (begin < low_water) {
+        // asked to go backwards, which only a seek can serve
+        seek(begin);
+    }
+    fill(end);
+    for (auto& aln : buffer) {
+        if (aln.Position > end) break;
+        if (aln.Position >= begin
+            || aln.GetEndPosition(false, true) >= begin) {
+            lambda(aln);
+        }
+    }
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef HHGA_SWEEP_H
+#define HHGA_SWEEP_H
+
+#include <deque>
+#include <string>
+#include <functional>
+#include "bamtools/api/BamMultiReader.h"
+
+namespace hhga {
+
+using namespace std;
+
+// past this many bp between sites it is cheaper to seek than to read through
+#define SWEEP_MAX_GAP 65536
+
+// streams each contig once for sites that arrive in sorted order
+// alignments are held in a position-ordered buffer, and sites take slices of it
+// instead of seeking the BAM again for every window
+class SweepReader {
+public:
+    SweepReader(BamTools::BamMultiReader& r) : reader(r) { }
+
+    // move the sweep to a new site; alignments ending before pos are dropped
+    // sites must call this with non-decreasing positions to avoid a re-seek
+    void advance(const string& seq_name, int32_t pos);
+
+    // visit the alignments overlapping [begin, end], in file order,
+    // using the same overlap rule as BamReader's region filter
+    void for_each_overlap(int32_t begin, int32_t end,
+                          const function<void(BamTools::BamAlignment&)>& lambda);
+
+    size_t buffered(void) const { return buffer.size(); }
+
+private:
+    BamTools::BamMultiReader& reader;
+    deque<BamTools::BamAlignment> buffer;
+    string seq_name;
+    int ref_id = -1;
+    int32_t low_water = 0;
+    int32_t loaded_to = -1; // the buffer holds every alignment starting at or before here
+    bool exhausted = true;  // no more alignments on this contig
+    void seek(int32_t pos);
+    void fill(int32_t end);
+};
+
+}
+
+#endif
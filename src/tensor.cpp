@@ -0,0 +1,277 @@
+#include "tensor.hpp"
+#include "packed.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace hhga {
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+tensor_layout_t tensor_layout(const tensor_shape_t& shape) {
+    tensor_layout_t l;
+    size_t cells = shape.rows() * shape.width;
+    size_t offset = sizeof(tensor_record_header_t);
+    l.weights = offset;
+    offset += cells * sizeof(float);
+    l.match = offset;
+    offset += (shape.reads + shape.unitigs) * shape.haplotypes * sizeof(float);
+    l.qual = offset;
+    offset += shape.reads * shape.haplotypes * sizeof(float);
+    l.likelihood = offset;
+    offset += shape.genotypes * sizeof(float);
+    l.properties = offset;
+    offset += shape.reads * TENSOR_PROPERTIES * sizeof(float);
+    l.kgraph = offset;
+    offset += shape.kgraph * sizeof(float);
+    l.groups = offset;
+    offset += (shape.reads + shape.unitigs) * sizeof(int32_t);
+    l.escapes = offset;
+    offset += cells * sizeof(uint16_t);
+    l.symbols = offset;
+    offset += cells;
+    l.strings = offset;
+    return l;
+}
+
+tensor_builder_t::tensor_builder_t(string& b, const tensor_shape_t& s)
+    : shape(s), buffer(b), layout(tensor_layout(s)) {
+    // zeroes are the padding of every tensor
+    buffer.assign(layout.strings, '\0');
+}
+
+void tensor_builder_t::finish(const string& repr, const string& label, const string& sequences) {
+    header().repr_length = repr.size();
+    header().label_length = label.size();
+    header().sequences_length = sequences.size();
+    buffer.append(repr);
+    buffer.append(label);
+    buffer.append(sequences);
+    buffer.resize(align8(buffer.size()), '\0');
+    header().size = buffer.size();
+}
+
+const string tensor_record_t::allele(size_t cell) const {
+    char c = packed_char(symbols()[cell]);
+    if (c) return string(1, c);
+    // the escape'th newline-ended sequence
+    size_t k = escapes()[cell];
+    const char* p = data + layout->strings + header().repr_length + header().label_length;
+    const char* end = p + header().sequences_length;
+    for (; k > 1 && p < end; --k) {
+        p = (const char*)memchr(p, '\n', end - p) + 1;
+    }
+    if (!k || p >= end) return "";
+    return string(p, (const char*)memchr(p, '\n', end - p) - p);
+}
+
+TensorShardWriter::TensorShardWriter(const string& p, const tensor_shape_t& s, size_t r)
+    : prefix(p), shape(s), records_per_shard(r) { }
+
+TensorShardWriter::~TensorShardWriter(void) {
+    if (file) close_shard();
+}
+
+bool TensorShardWriter::open_shard(void) {
+    stringstream name;
+    name << prefix << "." << shards << TENSOR_SUFFIX;
+    file = fopen(name.str().c_str(), "wb");
+    if (!file) {
+        cerr << "[hhga] could not open " << name.str() << " for writing" << endl;
+        return false;
+    }
+    ++shards;
+    // the header is rewritten once the record count is known
+    tensor_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, file);
+    offsets.clear();
+    offsets.push_back(sizeof(header));
+    return true;
+}
+
+bool TensorShardWriter::close_shard(void) {
+    tensor_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TENSOR_MAGIC, 8);
+    header.shape = shape;
+    header.record_count = offsets.size() - 1;
+    header.table_offset = offsets.back();
+    bool ok = fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size()
+        && fseek(file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+bool TensorShardWriter::write_record(const char* record, size_t size) {
+    if (!file || offsets.size() > records_per_shard) {
+        if (file && !close_shard()) return false;
+        if (!open_shard()) return false;
+    }
+    if (fwrite(record, 1, size, file) != size) return false;
+    offsets.push_back(offsets.back() + size);
+    return true;
+}
+
+streamsize TensorShardWriter::xsputn(const char* s, streamsize n) {
+    if (failed) return 0;
+    // the ReorderBuffer writes whole records, which go straight through,
+    // but a record split across writes waits in partial
+    bool buffered = !partial.empty();
+    if (buffered) {
+        partial.append(s, n);
+    }
+    const char* p = buffered ? partial.data() : s;
+    const char* end = buffered ? p + partial.size() : s + n;
+    uint64_t size;
+    while (!failed && (size_t)(end - p) >= sizeof(size)) {
+        memcpy(&size, p, sizeof(size));
+        if (size < sizeof(tensor_record_header_t)) {
+            cerr << "[hhga] malformed tensor record" << endl;
+            failed = true;
+            break;
+        }
+        if ((size_t)(end - p) < size) break;
+        failed = !write_record(p, size);
+        p += size;
+    }
+    if (buffered) {
+        partial.erase(0, p - partial.data());
+    } else {
+        partial.assign(p, end - p);
+    }
+    return failed ? 0 : n;
+}
+
+int TensorShardWriter::overflow(int c) {
+    if (c == traits_type::eof()) return traits_type::not_eof(c);
+    char ch = c;
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+bool TensorShardWriter::close(void) {
+    // a run without sites still leaves an empty shard, so readers find something
+    if (!shards && !failed && !open_shard()) failed = true;
+    if (file && !close_shard()) failed = true;
+    if (!partial.empty()) {
+        cerr << "[hhga] a tensor record was cut short" << endl;
+        partial.clear();
+        failed = true;
+    }
+    if (failed) {
+        cerr << "[hhga] error writing tensor shards to " << prefix << endl;
+        failed = false;
+        return false;
+    }
+    return true;
+}
+
+TensorShard::~TensorShard(void) {
+    if (data) munmap((void*)data, data_size);
+}
+
+bool TensorShard::open(const string& file_name) {
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cerr << "[hhga] could not open " << file_name << endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(tensor_file_header_t)) {
+        cerr << "[hhga] " << file_name << " is not an hhga tensor shard" << endl;
+        ::close(fd);
+        return false;
+    }
+    data_size = st.st_size;
+    void* mapped = mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "[hhga] could not map " << file_name << endl;
+        data_size = 0;
+        return false;
+    }
+    data = (const char*)mapped;
+    if (memcmp(header()->magic, TENSOR_MAGIC, 8) != 0
+        || header()->table_offset + (header()->record_count + 1) * sizeof(uint64_t) > data_size) {
+        cerr << "[hhga] " << file_name << " is not an hhga tensor shard, or is truncated" << endl;
+        munmap((void*)data, data_size);
+        data = nullptr;
+        data_size = 0;
+        return false;
+    }
+    layout = tensor_layout(header()->shape);
+    table = (const uint64_t*)(data + header()->table_offset);
+    return true;
+}
+
+tensor_record_t TensorShard::record(size_t i) const {
+    return tensor_record_t(data + table[i], &layout);
+}
+
+void TensorShard::for_each(const function<void(const tensor_record_t&)>& lambda) const {
+    for (size_t i = 0; i < size(); ++i) {
+        lambda(record(i));
+    }
+}
+
+void printViewTensorsUsage(int argc, char** argv) {
+    cerr << "usage: " << argv[0] << " SHARD..." << endl
+         << endl
+         << "Prints the shape of each shard written by hhga --tensors, then the name, label and" << endl
+         << "reference, haplotype and genotype rows of each record, drawn as --text-viz draws them." << endl;
+}
+
+int main_view_tensors(int argc, char** argv) {
+    if (argc < 2 || string(argv[1]) == "-h" || string(argv[1]) == "--help") {
+        printViewTensorsUsage(argc, argv);
+        return argc < 2 ? 1 : 0;
+    }
+    for (int i = 1; i < argc; ++i) {
+        TensorShard shard;
+        if (!shard.open(argv[i])) {
+            return 1;
+        }
+        auto& shape = shard.shape();
+        cout << "#records " << shard.size()
+             << " width " << shape.width
+             << " haplotypes " << shape.haplotypes
+             << " genotypes " << shape.genotypes
+             << " reads " << shape.reads
+             << " unitigs " << shape.unitigs
+             << " kgraph " << shape.kgraph << endl;
+        auto put_row = [&](const tensor_record_t& record, const char* name, size_t row) {
+            cout << name;
+            for (size_t c = row * shape.width; c < (row + 1) * shape.width; ++c) {
+                auto allele = record.allele(c);
+                if (allele == "M") cout << " ";
+                else if (allele == "U") cout << "-";
+                else if (allele == "R") cout << ".";
+                else cout << allele;
+            }
+            cout << endl;
+        };
+        shard.for_each([&](const tensor_record_t& record) {
+                auto& header = record.header();
+                cout << record.repr() << "\t" << record.label() << endl;
+                put_row(record, "reference          ", 0);
+                for (size_t h = 0; h < header.haplotypes; ++h) {
+                    put_row(record, "hap                ", 1 + h);
+                }
+                for (size_t g = 0; g < header.genotypes; ++g) {
+                    put_row(record, "geno               ", 1 + shape.haplotypes + g);
+                }
+            });
+    }
+    return 0;
+}
+
+}
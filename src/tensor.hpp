@@ -0,0 +1,182 @@
+#ifndef HHGA_TENSOR_H
+#define HHGA_TENSOR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cmath>
+#include <streambuf>
+#include <functional>
+
+namespace hhga {
+
+using namespace std;
+
+#define TENSOR_MAGIC "HHGATNS2"
+#define TENSOR_SUFFIX ".hhts"
+#define TENSOR_PROPERTIES 11
+#define TENSOR_SHARD_RECORDS 65536
+
+// the shape every record in a shard is padded or truncated to
+struct tensor_shape_t {
+    uint32_t width;      // MSA columns
+    uint32_t haplotypes; // also the columns of match and qual
+    uint32_t genotypes;  // also the length of likelihood
+    uint32_t reads;      // grouped reads, in the order of the |aln namespaces
+    uint32_t unitigs;
+    uint32_t kgraph;     // graph nodes, in id order
+    // MSA rows: the reference, then haplotypes, genotypes, reads and unitigs
+    size_t rows(void) const { return 1 + haplotypes + genotypes + reads + unitigs; }
+};
+
+// byte offsets of each tensor from the start of a record
+// every record of a shape has the same layout, so a reader computes it once
+struct tensor_layout_t {
+    size_t weights;     // float[rows][width], the quality weight of each cell
+    size_t match;       // float[reads + unitigs][haplotypes], |match then |xmatch
+    size_t qual;        // float[reads][haplotypes]
+    size_t likelihood;  // float[genotypes]
+    size_t properties;  // float[reads][TENSOR_PROPERTIES], as in |properties
+    size_t kgraph;      // float[kgraph], as in |kgraph
+    size_t groups;      // int32[reads + unitigs], the allele each read was grouped under
+    size_t escapes;     // uint16[rows][width], where a symbol is PACKED_ESCAPE, 1 + the index
+                        // of its allele in the record's sequences, and 0 elsewhere
+    size_t symbols;     // uint8[rows][width], packed_symbol codes, 0 where missing or padding
+    size_t strings;     // the site's repr, its label, then its sequences, which vary in length
+};
+
+tensor_layout_t tensor_layout(const tensor_shape_t& shape);
+
+// on-disk layout, all offsets are from the start of the file
+// records are 8-byte aligned, and the offset table follows the last one
+struct tensor_file_header_t {
+    char magic[8];
+    tensor_shape_t shape;
+    uint32_t padding;
+    uint64_t record_count;
+    uint64_t table_offset; // uint64_t[record_count + 1], the last is the end of the records
+};
+
+// leads each record, giving the rows of each block that are in use
+struct tensor_record_header_t {
+    uint64_t size; // bytes, including this header and the alignment padding
+    uint32_t haplotypes;
+    uint32_t genotypes;
+    uint32_t reads;
+    uint32_t unitigs;
+    uint32_t kgraph;
+    uint32_t depth;       // as in |depth
+    uint32_t graph_depth;
+    uint32_t repr_length;
+    uint32_t label_length;
+    uint32_t sequences_length; // the alleles escapes refer to, each ended by a newline
+};
+
+// nan and inf are stored as 0, as they are in the vw output
+inline float tensor_value(double v) {
+    return std::isfinite(v) ? v : 0;
+}
+
+// a record in a mapped shard, read in place
+class tensor_record_t {
+public:
+    tensor_record_t(const char* d, const tensor_layout_t* l) : data(d), layout(l) { }
+    const tensor_record_header_t& header(void) const { return *(const tensor_record_header_t*)data; }
+    const float* weights(void) const { return (const float*)(data + layout->weights); }
+    const float* match(void) const { return (const float*)(data + layout->match); }
+    const float* qual(void) const { return (const float*)(data + layout->qual); }
+    const float* likelihood(void) const { return (const float*)(data + layout->likelihood); }
+    const float* properties(void) const { return (const float*)(data + layout->properties); }
+    const float* kgraph(void) const { return (const float*)(data + layout->kgraph); }
+    const int32_t* groups(void) const { return (const int32_t*)(data + layout->groups); }
+    const uint16_t* escapes(void) const { return (const uint16_t*)(data + layout->escapes); }
+    const uint8_t* symbols(void) const { return (const uint8_t*)(data + layout->symbols); }
+    const string repr(void) const { return string(data + layout->strings, header().repr_length); }
+    const string label(void) const {
+        return string(data + layout->strings + header().repr_length, header().label_length);
+    }
+    // the allele of a cell, by its symbol and escape
+    const string allele(size_t cell) const;
+private:
+    const char* data;
+    const tensor_layout_t* layout;
+};
+
+// builds one record at a time in a reusable buffer
+class tensor_builder_t {
+public:
+    tensor_builder_t(string& b, const tensor_shape_t& s);
+    tensor_record_header_t& header(void) { return *(tensor_record_header_t*)&buffer[0]; }
+    float* weights(void) { return (float*)&buffer[layout.weights]; }
+    float* match(void) { return (float*)&buffer[layout.match]; }
+    float* qual(void) { return (float*)&buffer[layout.qual]; }
+    float* likelihood(void) { return (float*)&buffer[layout.likelihood]; }
+    float* properties(void) { return (float*)&buffer[layout.properties]; }
+    float* kgraph(void) { return (float*)&buffer[layout.kgraph]; }
+    int32_t* groups(void) { return (int32_t*)&buffer[layout.groups]; }
+    uint16_t* escapes(void) { return (uint16_t*)&buffer[layout.escapes]; }
+    uint8_t* symbols(void) { return (uint8_t*)&buffer[layout.symbols]; }
+    // appends the strings and pads the record, after which it is complete
+    // sequences holds the alleles escapes refer to, each ended by a newline
+    void finish(const string& repr, const string& label, const string& sequences);
+    const tensor_shape_t shape;
+private:
+    string& buffer;
+    tensor_layout_t layout;
+};
+
+// splits a stream of records, as written in order by the ReorderBuffer,
+// into shards of at most records_per_shard records named PREFIX.N.hhts
+class TensorShardWriter : public streambuf {
+public:
+    TensorShardWriter(const string& prefix, const tensor_shape_t& shape,
+                      size_t records_per_shard = TENSOR_SHARD_RECORDS);
+    TensorShardWriter(const TensorShardWriter&) = delete;
+    ~TensorShardWriter(void);
+    // writes the offset table of the last shard, returning false if anything failed
+    bool close(void);
+    size_t shard_count(void) const { return shards; }
+protected:
+    streamsize xsputn(const char* s, streamsize n);
+    int overflow(int c);
+private:
+    string prefix;
+    tensor_shape_t shape;
+    size_t records_per_shard;
+    size_t shards = 0;
+    bool failed = false;
+    FILE* file = nullptr;
+    string partial; // a record split across writes
+    vector<uint64_t> offsets;
+    bool write_record(const char* record, size_t size);
+    bool open_shard(void);
+    bool close_shard(void);
+};
+
+// a memory-mapped shard, whose records are read without copying
+class TensorShard {
+public:
+    TensorShard(void) : data(nullptr), data_size(0) { }
+    TensorShard(const TensorShard&) = delete;
+    ~TensorShard(void);
+    bool open(const string& file_name);
+    bool is_open(void) const { return data != nullptr; }
+    const tensor_shape_t& shape(void) const { return header()->shape; }
+    size_t size(void) const { return header()->record_count; }
+    tensor_record_t record(size_t i) const;
+    void for_each(const function<void(const tensor_record_t&)>& lambda) const;
+private:
+    const char* data;
+    size_t data_size;
+    tensor_layout_t layout;
+    const uint64_t* table;
+    const tensor_file_header_t* header(void) const { return (const tensor_file_header_t*)data; }
+};
+
+int main_view_tensors(int argc, char** argv);
+
+}
+
+#endif
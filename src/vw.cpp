@@ -0,0 +1,165 @@
+#include "vw.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace hhga {
+
+struct vw_numbers_t {
+    string names[VW_INTERNED_NUMBERS];
+    vw_numbers_t(void) {
+        for (int i = 0; i < VW_INTERNED_NUMBERS; ++i) {
+            names[i] = to_string(i);
+        }
+    }
+};
+
+static const vw_numbers_t vw_numbers;
+
+void vw_append_unsigned(string& buf, uint64_t v) {
+    if (v < VW_INTERNED_NUMBERS) {
+        buf.append(vw_numbers.names[v]);
+        return;
+    }
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) buf.push_back(digits[--n]);
+}
+
+// whole numbers below 1e6 print without an exponent or point under %g,
+// and most weights are phred scores or counts, so they skip printf
+void vw_append_double(string& buf, double v) {
+    // vw can't learn from nan or inf, which can come from empty sites
+    if (!std::isfinite(v)) {
+        buf.push_back('0');
+        return;
+    }
+    if (fabs(v) < 1e6 && v == floor(v)) {
+        if (signbit(v)) buf.push_back('-');
+        vw_append_unsigned(buf, (uint64_t)fabs(v));
+        return;
+    }
+    char s[32];
+    int n = snprintf(s, sizeof(s), "%g", v);
+    buf.append(s, n);
+}
+
+void vw_append_long_double(string& buf, long double v) {
+    if (!std::isfinite(v)) {
+        buf.push_back('0');
+        return;
+    }
+    if (fabsl(v) < 1e6 && v == floorl(v)) {
+        if (signbit(v)) buf.push_back('-');
+        vw_append_unsigned(buf, (uint64_t)fabsl(v));
+        return;
+    }
+    char s[48];
+    int n = snprintf(s, sizeof(s), "%Lg", v);
+    buf.append(s, n);
+}
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+uint32_t vw_uniform_hash(const char* s, size_t len, uint32_t seed) {
+    const uint8_t* data = (const uint8_t*)s;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h = seed;
+    size_t blocks = len / 4;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint32_t k;
+        memcpy(&k, data + i * 4, 4);
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+    const uint8_t* tail = data + blocks * 4;
+    uint32_t k = 0;
+    switch (len & 3) {
+    case 3: k ^= tail[2] << 16;
+    case 2: k ^= tail[1] << 8;
+    case 1: k ^= tail[0];
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+    }
+    h ^= (uint32_t)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+uint64_t vw_hashstring(const char* s, size_t len, uint64_t seed) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return vw_uniform_hash(s, len, (uint32_t)seed);
+        }
+        value = 10 * value + (s[i] - '0');
+    }
+    return value + seed;
+}
+
+// bounds the cache on sites with many distinct names, such as large graphs
+#define VW_HASH_CACHE_MAX (1 << 22)
+
+vw_hasher_t::vw_hasher_t(int bits)
+    : mask(bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1) { }
+
+void vw_hasher_t::hash(const char* p, const char* end, string& out) {
+    // the label and tag come before the first namespace
+    const char* bar = (const char*)memchr(p, '|', end - p);
+    if (!bar) bar = end;
+    out.append(p, bar);
+    p = bar;
+    namespace_t* ns = nullptr;
+    while (p < end) {
+        const char* token = p;
+        while (p < end && *p != ' ') ++p;
+        if (*token == '|') {
+            if (cached > VW_HASH_CACHE_MAX) {
+                namespaces.clear();
+                cached = 0;
+            }
+            name.assign(token + 1, p - token - 1);
+            auto f = namespaces.find(name);
+            if (f == namespaces.end()) {
+                f = namespaces.insert(make_pair(name, namespace_t())).first;
+                // the default namespace, "| ", is seeded with 0
+                f->second.hash = name.empty() ? 0 : vw_hashstring(name.data(), name.size(), 0);
+            }
+            ns = &f->second;
+            out.append(token, p);
+        } else if (p > token) {
+            const char* colon = (const char*)memchr(token, ':', p - token);
+            const char* name_end = colon ? colon : p;
+            name.assign(token, name_end);
+            auto f = ns->features.find(name);
+            if (f == ns->features.end()) {
+                uint64_t h = vw_hashstring(name.data(), name.size(), ns->hash);
+                f = ns->features.insert(make_pair(name, (h - ns->hash) & mask)).first;
+                ++cached;
+            }
+            vw_append_unsigned(out, f->second);
+            out.append(name_end, p);
+        }
+        // keep the separators as they were
+        while (p < end && *p == ' ') out.push_back(*p++);
+    }
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef HHGA_VW_H
+#define HHGA_VW_H
+
+#include <string>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+
+namespace hhga {
+
+using namespace std;
+
+// the decimal names of small numbers are interned, as every MSA cell and column
+// feature begins with its index in the window
+#define VW_INTERNED_NUMBERS 4096
+
+void vw_append_unsigned(string& buf, uint64_t v);
+// formats as an ostream with default flags would, which is printf's %g,
+// except that nan and inf are written as 0
+void vw_append_double(string& buf, double v);
+void vw_append_long_double(string& buf, long double v);
+
+// appends vw examples to a reusable buffer rather than going through iostreams
+class vw_writer_t {
+public:
+    vw_writer_t(string& b) : buf(b) { }
+    vw_writer_t& operator<<(const string& s) { buf.append(s); return *this; }
+    vw_writer_t& operator<<(const char* s) { buf.append(s); return *this; }
+    vw_writer_t& operator<<(char c) { buf.push_back(c); return *this; }
+    vw_writer_t& operator<<(double v) { vw_append_double(buf, v); return *this; }
+    vw_writer_t& operator<<(float v) { vw_append_double(buf, v); return *this; }
+    vw_writer_t& operator<<(long double v) { vw_append_long_double(buf, v); return *this; }
+    template <class T>
+    typename enable_if<is_integral<T>::value, vw_writer_t&>::type operator<<(T v) {
+        if (v < 0) {
+            buf.push_back('-');
+            vw_append_unsigned(buf, -(uint64_t)v);
+        } else {
+            vw_append_unsigned(buf, v);
+        }
+        return *this;
+    }
+private:
+    string& buf;
+};
+
+// vw's uniform_hash, which is murmurhash3_x86_32
+uint32_t vw_uniform_hash(const char* s, size_t len, uint32_t seed);
+// how vw hashes a namespace or feature name: names that are all digits
+// are taken as their value, offset by the seed, and the rest are hashed
+uint64_t vw_hashstring(const char* s, size_t len, uint64_t seed);
+
+// rewrites examples with each feature name replaced by a number that vw
+// maps to the same weight, so vw skips hashing the names
+// vw adds the namespace's hash to numeric names, so we write the feature's
+// hash less the namespace's, modulo 2^bits, which gives the same index for
+// any vw run with -b up to bits
+// the hashes are cached, as the names repeat from site to site for a given window geometry
+class vw_hasher_t {
+public:
+    vw_hasher_t(int bits = 32);
+    // append the hashed form of the example in [begin, end) to out
+    void hash(const char* begin, const char* end, string& out);
+private:
+    uint64_t mask;
+    struct namespace_t {
+        uint32_t hash;
+        unordered_map<string, uint64_t> features;
+    };
+    unordered_map<string, namespace_t> namespaces;
+    size_t cached = 0;
+    string name;
+};
+
+}
+
+#endif
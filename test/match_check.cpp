@@ -0,0 +1,115 @@
+#include "hhga.hpp"
+#include <random>
+#include <cstring>
+
+// checks that msa_t::match gives bit for bit the pairwise_identity and pairwise_qualsum
+// of the unpacked rows, through both the SSE4.1 and the scalar packed_compare
+// usage: hhga_match_check [DIR], run by test/t/01_hhga.t
+// compares every read against every haplotype of the sites in DIR, then every pair of
+// random rows of single bases, MSA symbols and multi-base alleles, and prints a line
+// for each: its name, the pairs compared, those with cells that are both escapes,
+// and those that differ, exiting 1 if any do
+
+using namespace std;
+using namespace hhga;
+
+struct match_check_t {
+    size_t pairs = 0;
+    size_t escaped = 0;
+    size_t differ = 0;
+};
+
+static void check_pair(msa_t& msa, size_t r1, size_t r2, match_check_t& check) {
+    auto h1 = msa.row(r1);
+    auto h2 = msa.row(r2);
+    double identity = pairwise_identity(h1, h2);
+    double qualsum = pairwise_qualsum(h1, h2);
+    for (auto compare : { packed_compare, packed_compare_scalar }) {
+        double packed_identity, packed_qualsum;
+        msa.match(r1, r2, packed_identity, packed_qualsum, compare);
+        if (memcmp(&identity, &packed_identity, sizeof(double))
+            || memcmp(&qualsum, &packed_qualsum, sizeof(double))) {
+            cerr << "[hhga] rows " << r1 << " and " << r2 << " give "
+                 << setprecision(17) << identity << " " << qualsum << " unpacked, and "
+                 << packed_identity << " " << packed_qualsum
+                 << (compare == packed_compare ? " packed" : " packed without SSE4.1") << endl;
+            ++check.differ;
+        }
+    }
+    ++check.pairs;
+    for (size_t i = 0; i < min(h1.size(), h2.size()); ++i) {
+        if (packed_symbol(h1[i].alt) == PACKED_ESCAPE
+            && packed_symbol(h2[i].alt) == PACKED_ESCAPE) {
+            ++check.escaped;
+            break;
+        }
+    }
+}
+
+static void report(const string& name, const match_check_t& check) {
+    cout << name << " " << check.pairs << " " << check.escaped << " " << check.differ << endl;
+}
+
+int main(int argc, char** argv) {
+
+    string dir = argc > 1 ? argv[1] : "test/minigiab";
+
+    inputs_t in;
+    if (!in.open({ dir + "/NA12878.chr22.tiny.bam" }, { }, dir + "/q.fa")) {
+        return 1;
+    }
+
+    // every read against every haplotype, as the constructor matches them
+    match_check_t sites;
+    hhga_options_t options;
+    auto all_genotypes = possible_genotypes(16, 2);
+    for (auto& vcf_file_name : { dir + "/NA12878.chr22.tiny.giab.vcf.gz", dir + "/h.vcf.gz" }) {
+        vcflib::VariantCallFile vcf_file;
+        vcf_file.open(vcf_file_name);
+        if (!vcf_file.is_open()) {
+            cerr << "[hhga] could not open " << vcf_file_name << endl;
+            return 1;
+        }
+        vcflib::Variant var(vcf_file);
+        while (vcf_file.getNextVariant(var)) {
+            HHGA site(var, in, options, all_genotypes);
+            for (size_t r = 0; r < site.alignments.size(); ++r) {
+                for (size_t h = 0; h < site.haplotypes.size(); ++h) {
+                    check_pair(site.msa, site.read_row_offset + r, 1 + h, sites);
+                }
+            }
+        }
+    }
+    report("sites", sites);
+
+    // rows of every length, over widths that fill whole and partial words
+    match_check_t random;
+    const allele_code_t codes[] = { 'A', 'C', 'G', 'T', 'N', 'R', 'U', 'S', 'M', 'a', 'u', '*',
+                                    ALLELE_EMPTY, ALLELE_SEQ_BASE, ALLELE_SEQ_BASE + 1,
+                                    ALLELE_SEQ_BASE + 2 };
+    mt19937 rng(42);
+    size_t code_count = sizeof(codes) / sizeof(codes[0]);
+    uniform_real_distribution<double> prob(0, 1);
+    for (size_t width : { 1, 15, 16, 17, 31, 50, 64, 100, 257 }) {
+        size_t rows = 24;
+        msa_t msa;
+        msa.reset(rows, width);
+        for (size_t r = 0; r < rows; ++r) {
+            size_t length = uniform_int_distribution<size_t>(0, width)(rng);
+            // rows drawn from fewer of the codes agree more often
+            uniform_int_distribution<size_t> pick(0, 1 + r % (code_count - 1));
+            for (size_t i = 0; i < length; ++i) {
+                msa.push_back(r, allele_t(ALLELE_EMPTY, codes[pick(rng)], i, prob(rng)));
+            }
+        }
+        msa.pack();
+        for (size_t r1 = 0; r1 < rows; ++r1) {
+            for (size_t r2 = 0; r2 < rows; ++r2) {
+                check_pair(msa, r1, r2, random);
+            }
+        }
+    }
+    report("random", random);
+
+    return sites.differ || random.differ ? 1 : 0;
+}
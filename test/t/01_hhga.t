@@ -7,21 +7,109 @@ PATH=../bin:$PATH # for vg
 
 export LC_ALL="C" # force a consistent sort order 
 
-plan tests 8
+plan tests 42
 
 hhga -h 2>/dev/null
 is $? 0 "hhga help runs"
 
-is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -t -r q:10502-10562 | md5sum | cut -f 1 -d\ ) 72e29b7afcafad482de22f28640ced46 "expected output produced for a test region"
+hhga_match_check minigiab >match_check.txt
+is $? 0 "packed matching gives exactly the pairwise identity and quality sums, with and without SSE4.1"
+is $(awk '$1 == "sites" && $2 > 0' match_check.txt | wc -l) 1 "every read of the test sites is matched against every haplotype"
+is $(awk '$1 == "random" && $3 > 0' match_check.txt | wc -l) 1 "multi-base and escaped alleles are matched"
+rm -f match_check.txt
 
-is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) 1f4a6f8ce14e69b0e83cb0c5d6158667 "expected vw-format output produced for a test region"
+# the test region holds one biallelic SNP
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -t | grep -c '^\(hap\|geno\) ') 4 "the text output shows the haplotypes and the sample's genotype for a test region"
+
+is "$(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | grep -o '|likelihood [^|]*' | grep -o '[0-9]*G:' | tr '\n' ' ')" "1G: 2G: 17G: " "likelihoods are keyed by genotype class"
+
+is "$(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | grep -o '|\(match\|qual\)[^|]*' | grep -o ' [0-9]*H:' | sort -u | tr -d '\n')" " 1H: 2H:" "reads are matched against the haplotypes of the site's alleles"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -j 4 | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "threaded vw-format output matches the serial output"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -q | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "sorted sweep output matches per-site seeking"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -R | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "packed reference cache output matches fastahack"
+rm -f minigiab/q.fa.hhref
+
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -j 4 -O output_test.vw.gz
+is $(zcat output_test.vw.gz | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "compressed output holds the uncompressed output"
+rm -f output_test.vw.gz
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -O - | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "an output of - writes to stdout"
+is $(ls -- - 2>/dev/null | wc -l) 0 "an output of - makes no file"
+
+for seed in 0 7; do
+    is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -D 3 -Z $seed -j 4 | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -D 3 -Z $seed -j 1 | md5sum | cut -f 1 -d\ ) "downsampling below coverage with seed $seed keeps the same reads when threaded"
+done
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -x 10 -D 100000 -t | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -x 10 -t | md5sum | cut -f 1 -d\ ) "downsampling above coverage leaves the max-depth grouping unchanged"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -j 4 -M 2>/dev/null | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | md5sum | cut -f 1 -d\ ) "memory stats leave the threaded output as the serial output"
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -j 4 -M 2>&1 >/dev/null | grep -c -e '^\[hhga\] thread' -e '^\[hhga\] peak RSS') 5 "memory stats report each thread and the peak RSS"
+
+hhga index-ref -f minigiab/q.fa -w 50 -E 1.8 -o q.hhrep
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -E 1.8 -I q.hhrep | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -E 1.8 | md5sum | cut -f 1 -d\ ) "repeat track output matches computing the callable windows"
+rm -f q.hhrep
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -H -B 18 | wc -w) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | wc -w) "hashed vw output has a feature for every named one"
+
+is "$(echo "1 '_q_1_C_A |ref 1A:30 42:1" | hhga -H -B 18)" "1 '_q_1_C_A |ref 9013:30 42:1" "hashed names are the indices vw gives them, and numeric names are kept"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -H -B 18 | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | hhga -H -B 18 | md5sum | cut -f 1 -d\ ) "hashing the examples as they are written equals hashing them afterwards"
+
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -H -t >/dev/null 2>&1
+is $? 1 "hashed names are not written in text output"
+
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -H -X tensor_test >/dev/null 2>&1
+is $? 1 "hashed names are not written in tensors"
+rm -f tensor_test.*.hhts
+
+is "$(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -F ref,hap | tr ' ' '\n' | grep '^|' | sed 's/[0-9]*$//' | sort -u | tr '\n' ' ')" "|hap |ref " "feature selection writes only the chosen namespaces"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -T - 2>&1 >/dev/null | grep -m 1 '"sites"' | tr -dc 0-9) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | wc -l) "the stats report counts every site"
+
+is $(paste <(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -F kgraph | tr ' ' '\n' | grep '^[0-9]*C:') \
+             <(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -F kgraph -K | tr ' ' '\n' | grep '^[0-9]*C:') \
+         | awk -F '[:\t]' '{ d = $2 - $4; if (d < 0) d = -d; m = $2 > $4 ? $2 : $4; if ($1 != $3 || d > 0.1 * m + 1) bad++ } END { print bad + 0 }') 0 "bubble alignment node coverage is within the tolerance of vg's"
 
 is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/h.vcf.gz -r q:9251-9252 -t -sa | grep ^hap | grep 'AAG----' | wc -l ) 1 "a normalized left-aligned indel is properly handled in the haplotypes"
 
 is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/h.vcf.gz  -w 64 -t | grep 'S\.' | wc -l) 14 "soft clips are annotated as expected"
 
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/h.vcf.gz  -w 16 -t | grep 'S\.' | wc -l | awk '{ print ($1 > 0 && $1 <= 14) }') 1 "soft clips of reads cut by a narrow window are still placed"
+
 is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -w 32 -s -t | grep "AAAAACAAAAAAC-AA-AAAAAAAAGGAAGGA" | wc -l ) 1 "reference allele compression is configurable"
 
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 -X tensor_test
+is $(hhga view-tensors tensor_test.0.hhts | head -1 | cut -f 2 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | wc -l) "a tensor shard holds a record for every site"
+is "$(hhga view-tensors tensor_test.0.hhts | head -1 | cut -f 3-4,13-14 -d\ )" "width 50 kgraph 100" "a tensor shard has the shape of the window"
+is $(hhga view-tensors tensor_test.0.hhts | grep -E '^(reference|hap|geno) ' | sed 's/ *$//' | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -t | grep -E '^(reference|hap|geno) ' | sed 's/ *$//' | md5sum | cut -f 1 -d\ ) "tensor records read back with the MSA rows of the text output"
+rm -f tensor_test.*.hhts
+
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -X tensor_test -t >/dev/null 2>&1
+is $? 1 "tensors and text output are not written together"
+rm -f tensor_test.*.hhts
+
+rm -f tensor_test.out
+hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -X tensor_test -O tensor_test.out >/dev/null 2>&1
+is $? 1 "tensors are not written with an output file"
+is $(ls tensor_test.out tensor_test.*.hhts 2>/dev/null | wc -l) 0 "no files are left when tensors are asked for with an output file"
+
 is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | hhga -p | md5sum | cut -f 1 -d\ ) fa6d278a26e3477df10131767d6ee5ac "expected vcf-format output produced for a test region"
 
 is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -g GT | hhga -G | md5sum | cut -f 1 -d\ ) a5cde582888857a67712dc28b0fe7666 "expected vcf-format output produced for a test region with genotype class"
+
+is $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | hhga -p -v minigiab/NA12878.chr22.tiny.giab.vcf.gz | grep -v '^#' | grep -c 'prediction=') $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r q:10502-10562 -c 1 | wc -l) "predictions annotate the records of the candidate VCF"
+
+hhga plan -b minigiab/NA12878.chr22.tiny.bam -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -n 3 -o plan_test >plan_test.tsv
+grep -v '^#' plan_test.tsv | while read shard region sites cost output; do
+    hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -r $region -c 1 >$output
+done
+is $(hhga merge plan_test.tsv | md5sum | cut -f 1 -d\ ) $(hhga -b minigiab/NA12878.chr22.tiny.bam -f minigiab/q.fa -v minigiab/NA12878.chr22.tiny.giab.vcf.gz -c 1 | md5sum | cut -f 1 -d\ ) "merged shard outputs match an unsharded run"
+rm -f plan_test*
+
+{ zcat minigiab/NA12878.chr22.tiny.giab.vcf.gz; zcat minigiab/NA12878.chr22.tiny.giab.vcf.gz | grep -v '^#' | tail -1 | sed 's/^q\t/z\t/'; } >plan_missing.vcf
+hhga plan -b minigiab/NA12878.chr22.tiny.bam -v plan_missing.vcf >/dev/null 2>&1
+is $? 1 "planning fails when candidates are on a contig missing from the BAM"
+rm -f plan_missing.vcf